@@ -0,0 +1,328 @@
+// Throughput of the host-side hot paths: pattern fill and verify per pattern and register
+// width, the pooled verify behind ITimer::performActionOnData, the duplex block compare and
+// result row serialisation. Results go to a JSON file with one benchmark per line, and a
+// previous file passed as baseline fails the run when a kernel got slower than the tolerance.
+#include "performance.h"
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BENCH_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+namespace
+{
+	struct Options
+	{
+		std::size_t min_size = 16;
+		std::size_t max_size = std::size_t(1) << 30;
+		double round_time = 0.05; // [s]
+		unsigned int rounds = 3;
+		double tolerance = 0.10;
+		std::string filter;
+		std::string output = "perf_bench.json";
+		std::string baseline;
+	};
+
+	struct Measurement
+	{
+		std::string name;
+		std::size_t bytes;
+		double bytes_per_second;
+		double cycles_per_byte; // TSC reference cycles, < 0 when not available
+	};
+
+	struct NamedValue
+	{
+		const char *name;
+		unsigned int value;
+	};
+
+	const NamedValue MODES[] {{"32bit", BIT32}, {"nonsym", NONSYM}};
+	const NamedValue PATTERNS[] {{"counter_8bit", COUNTER_8BIT}, {"counter_32bit", COUNTER_32BIT},
+		{"walking_1", WALKING_1}, {"asic", ASIC}, {"prbs7", PRBS7}, {"prbs15", PRBS15},
+		{"prbs23", PRBS23}, {"prbs31", PRBS31}};
+	const std::size_t DUPLEX_BLOCKS[] {16, 64, 256, 1024, 4096, 16384};
+	constexpr std::size_t DUPLEX_REGION {1 << 20};
+	// One flipped byte per 64 KiB lands in every verification shard
+	constexpr std::size_t CORRUPT_STRIDE {1 << 16};
+
+	uint64_t cycles()
+	{
+#ifdef BENCH_TSC
+		return __rdtsc();
+#else
+		return 0;
+#endif
+	}
+
+	void usage(const char *program)
+	{
+		std::cerr << "Usage: " << program << " [options]\n"
+				  << "  --min-size B       smallest buffer size (16)\n"
+				  << "  --max-size B       largest buffer size (1073741824)\n"
+				  << "  --round-time S     minimum duration of one timed round (0.05)\n"
+				  << "  --rounds N         timed rounds per benchmark, the fastest counts (3)\n"
+				  << "  --filter TEXT      only benchmarks whose name contains TEXT\n"
+				  << "  --output FILE      JSON results (perf_bench.json)\n"
+				  << "  --baseline FILE    earlier JSON results to compare against\n"
+				  << "  --tolerance F      allowed slowdown against the baseline (0.10)" << std::endl;
+	}
+
+	bool parseOptions(int argc, char *argv[], Options &options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string option = argv[i];
+			if (option == "--help" || i + 1 >= argc) return false;
+			std::string value = argv[++i];
+			if (option == "--min-size") options.min_size = std::stoull(value);
+			else if (option == "--max-size") options.max_size = std::stoull(value);
+			else if (option == "--round-time") options.round_time = std::stod(value);
+			else if (option == "--rounds") options.rounds = std::stoul(value);
+			else if (option == "--filter") options.filter = value;
+			else if (option == "--output") options.output = value;
+			else if (option == "--baseline") options.baseline = value;
+			else if (option == "--tolerance") options.tolerance = std::stod(value);
+			else return false;
+		}
+		// Buffer sizes reach DataGenerator as unsigned int
+		return options.min_size > 0 && options.min_size <= options.max_size &&
+			   options.max_size <= std::numeric_limits<unsigned int>::max() && options.rounds > 0;
+	}
+
+	// Doubles the repetitions until a round lasts round_time, then keeps the fastest of the rounds
+	Measurement measure(const Options &options, const std::string &name, std::size_t bytes,
+						const std::function<void()> &kernel)
+	{
+		unsigned long repetitions = 1;
+		auto timeRound = [&](uint64_t &round_cycles)
+		{
+			auto start = PerfClock::now();
+			uint64_t start_cycles = cycles();
+			for (unsigned long i = 0; i < repetitions; i++) kernel();
+			round_cycles = cycles() - start_cycles;
+			return std::chrono::duration<double>(PerfClock::now() - start).count();
+		};
+
+		uint64_t best_cycles;
+		double best_seconds = timeRound(best_cycles);
+		while (best_seconds < options.round_time)
+		{
+			repetitions *= 2;
+			best_seconds = timeRound(best_cycles);
+		}
+		for (unsigned int round = 1; round < options.rounds; round++)
+		{
+			uint64_t round_cycles;
+			double seconds = timeRound(round_cycles);
+			if (seconds < best_seconds)
+			{
+				best_seconds = seconds;
+				best_cycles = round_cycles;
+			}
+		}
+
+		const double total_bytes = static_cast<double>(bytes) * repetitions;
+		Measurement measurement{name, bytes, total_bytes / best_seconds, -1.0};
+		if (best_cycles > 0) measurement.cycles_per_byte = best_cycles / total_bytes;
+		return measurement;
+	}
+
+	// A row with every column set, as the sink formats see it
+	ResultRecord sampleRecord()
+	{
+		ResultRecord record;
+		int64_t value = 1;
+		for (const auto &column : resultColumns())
+		{
+			if (column.type == TEXT_FIELD) record.setText(column.name, "blockram");
+			else if (column.type == INTEGER_FIELD) record.setInteger(column.name, value * 65536);
+			else record.setReal(column.name, value * 123456.789);
+			value++;
+		}
+		return record;
+	}
+
+	std::map<std::string, double> readBaseline(const std::string &path)
+	{
+		std::map<std::string, double> baseline;
+		std::ifstream in(path);
+		if (!in.good()) LOG(FATAL) << "Unable to open baseline " << path;
+		const std::regex entry{"\"name\":\"([^\"]+)\".*\"bytes_per_second\":([-+.eE0-9]+)"};
+		std::string line;
+		std::smatch match;
+		while (std::getline(in, line))
+		{
+			if (std::regex_search(line, match, entry)) baseline[match[1]] = std::stod(match[2]);
+		}
+		return baseline;
+	}
+
+	void writeJson(const std::string &path, const std::vector<Measurement> &measurements)
+	{
+		std::ofstream out(path, std::ios::trunc);
+		if (!out.good()) LOG(FATAL) << "Unable to open " << path;
+		out << std::setprecision(6);
+		out << "{\"instruction_set\":\"" << datakernels::instructionSetName(datakernels::bestInstructionSet())
+			<< "\",\"benchmarks\":[\n";
+		for (std::size_t i = 0; i < measurements.size(); i++)
+		{
+			const Measurement &m = measurements[i];
+			out << "{\"name\":\"" << m.name << "\",\"bytes\":" << m.bytes << ",\"bytes_per_second\":"
+				<< m.bytes_per_second << ",\"cycles_per_byte\":";
+			if (m.cycles_per_byte < 0.0) out << "null";
+			else out << m.cycles_per_byte;
+			out << '}' << (i + 1 < measurements.size() ? "," : "") << '\n';
+		}
+		out << "]}\n";
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	google::InitGoogleLogging(argv[0]);
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		usage(argv[0]);
+		return 2;
+	}
+	std::map<std::string, double> baseline;
+	if (!options.baseline.empty()) baseline = readBaseline(options.baseline);
+
+	std::vector<std::size_t> sizes;
+	for (std::size_t size = options.min_size; size <= options.max_size; size *= 16) sizes.push_back(size);
+	if (sizes.back() != options.max_size) sizes.push_back(options.max_size);
+
+	std::unique_ptr<unsigned char[]> data(new unsigned char[options.max_size]);
+	std::unique_ptr<unsigned char[]> golden(new unsigned char[options.max_size]);
+	std::unique_ptr<unsigned char[]> corrupted(new unsigned char[options.max_size]);
+	VerifierPool verifier{std::max(1u, std::thread::hardware_concurrency())};
+
+	std::vector<Measurement> measurements;
+	auto run = [&](const std::string &name, std::size_t bytes, const std::function<void()> &kernel)
+	{
+		if (name.find(options.filter) == std::string::npos) return;
+		measurements.push_back(measure(options, name, bytes, kernel));
+		const Measurement &m = measurements.back();
+		std::cout << std::left << std::setw(44) << m.name << std::right << std::setw(12)
+				  << std::fixed << std::setprecision(1) << m.bytes_per_second / 1e6 << " MB/s";
+		if (m.cycles_per_byte >= 0.0) std::cout << std::setw(10) << std::setprecision(3) << m.cycles_per_byte << " c/B";
+		std::cout << std::defaultfloat << std::endl;
+	};
+
+	for (const auto &mode : MODES)
+	{
+		for (const auto &pattern : PATTERNS)
+		{
+			// Only the nonsym generator knows the ASIC pattern
+			if (pattern.value == ASIC && mode.value != NONSYM) continue;
+			const std::string suffix = std::string("/") + mode.name + "/" + pattern.name + "/";
+			for (std::size_t size : sizes)
+			{
+				const unsigned int pattern_size = static_cast<unsigned int>(size);
+				bool selected = false;
+				for (const char *kernel : {"fill", "verify", "verify_pool", "verify_pool_corrupt"})
+				{
+					selected = selected || (kernel + suffix + std::to_string(size)).find(options.filter) != std::string::npos;
+				}
+				if (!selected) continue;
+				DataGenerator(mode.value, pattern.value, pattern_size).fillArrayWithData(golden.get());
+				std::memcpy(data.get(), golden.get(), size);
+				// Every shard misses the memcmp fast path and is checked against the generator
+				std::memcpy(corrupted.get(), golden.get(), size);
+				for (std::size_t offset = 0; offset < size; offset += CORRUPT_STRIDE) corrupted[offset] ^= 0xff;
+
+				run("fill" + suffix + std::to_string(size), size, [&]
+				{
+					DataGenerator(mode.value, pattern.value, pattern_size).fillArrayWithData(data.get());
+				});
+				run("verify" + suffix + std::to_string(size), size, [&]
+				{
+					unsigned int errors = DataGenerator(mode.value, pattern.value, pattern_size)
+						.checkArrayForErrors(data.get());
+					if (errors) LOG(FATAL) << "Verify found " << errors << " errors in generated data";
+				});
+				run("verify_pool" + suffix + std::to_string(size), size, [&]
+				{
+					unsigned int errors = verifier.verify(mode.value, pattern.value, data.get(), pattern_size,
+														  golden.get());
+					if (errors) LOG(FATAL) << "Pooled verify found " << errors << " errors in generated data";
+				});
+				run("verify_pool_corrupt" + suffix + std::to_string(size), size, [&]
+				{
+					unsigned int errors = verifier.verify(mode.value, pattern.value, corrupted.get(), pattern_size,
+														  golden.get());
+					if (!errors) LOG(FATAL) << "Pooled verify missed the corrupted bytes";
+				});
+			}
+		}
+	}
+
+	const std::size_t region = std::min(DUPLEX_REGION, options.max_size);
+	std::memset(golden.get(), 0x5a, region);
+	std::memset(data.get(), 0x5a, region);
+	for (std::size_t block_size : DUPLEX_BLOCKS)
+	{
+		if (block_size > region) break;
+		const unsigned int blocks = static_cast<unsigned int>(region / block_size);
+		// Same hand-off as StreamingDuplex: block numbers queued to the checker thread, then one wait
+		ErrorReport report;
+		DuplexChecker checker(golden.get(), data.get(), static_cast<unsigned int>(block_size), report);
+		run("duplex_compare/" + std::to_string(block_size), blocks * block_size, [&]
+		{
+			for (unsigned int b = 0; b < blocks; b++)
+			{
+				checker.check(b);
+			}
+			if (checker.wait()) LOG(FATAL) << "Duplex compare found a mismatch";
+		});
+	}
+
+	const ResultRecord record = sampleRecord();
+	const std::vector<ResultColumn> &columns = resultColumns();
+	std::unique_ptr<IResultFormat> formats[] {std::unique_ptr<IResultFormat>(new CsvFormat(";")),
+		std::unique_ptr<IResultFormat>(new JsonLinesFormat()), std::unique_ptr<IResultFormat>(new BinaryFormat())};
+	const char *format_names[] {"csv", "jsonl", "binary"};
+	for (std::size_t f = 0; f < 3; f++)
+	{
+		std::ostringstream row;
+		formats[f]->writeRecord(row, columns, record);
+		std::ostringstream out;
+		run(std::string("serialize/") + format_names[f], row.str().size(), [&]
+		{
+			out.str("");
+			formats[f]->writeRecord(out, columns, record);
+		});
+	}
+
+	writeJson(options.output, measurements);
+	std::cout << "Results written to " << options.output << std::endl;
+
+	unsigned int regressions = 0;
+	for (const auto &m : measurements)
+	{
+		auto it = baseline.find(m.name);
+		if (it == baseline.end() || it->second <= 0.0) continue;
+		double change = m.bytes_per_second / it->second - 1.0;
+		if (change < -options.tolerance)
+		{
+			std::cout << "REGRESSION " << m.name << ": " << std::fixed << std::setprecision(1)
+					  << change * 100 << " % against the baseline" << std::defaultfloat << std::endl;
+			regressions++;
+		}
+	}
+	if (!baseline.empty())
+	{
+		std::cout << regressions << " regressions beyond " << std::fixed << std::setprecision(1)
+				  << options.tolerance * 100 << " % against " << options.baseline << std::endl;
+	}
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,160 @@
+#include "performance.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	constexpr std::size_t BUFFER_PAGE_SIZE {4096};
+	constexpr std::size_t BUFFER_HUGE_PAGE_SIZE {2 * 1024 * 1024};
+
+	std::size_t roundUpToPowerOfTwo(std::size_t size)
+	{
+		std::size_t capacity = BUFFER_PAGE_SIZE;
+		while (capacity < size) capacity <<= 1;
+		return capacity;
+	}
+}
+
+BufferPool::~BufferPool()
+{
+	for (const auto &buffer : buffers)
+	{
+		if (buffer.in_use) LOG(ERROR) << "Buffer of " << buffer.capacity << " B still in use";
+		deallocate(buffer);
+	}
+	LOG(INFO) << "Buffer pool: " << allocated << " buffers allocated, " << reused << " reused";
+	LOG(INFO) << "Peak resident memory: " << (peakResidentBytes() >> 20) << " MB";
+}
+
+// Hands out the smallest free buffer that fits, so a sweep only grows the pool for new sizes
+unsigned char *BufferPool::acquire(std::size_t size)
+{
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	Buffer *best = nullptr;
+	for (auto &buffer : buffers)
+	{
+		if (!buffer.in_use && buffer.capacity >= size && (!best || buffer.capacity < best->capacity))
+		{
+			best = &buffer;
+		}
+	}
+	if (best)
+	{
+		best->in_use = true;
+		reused++;
+		return best->data;
+	}
+
+	std::size_t capacity = roundUpToPowerOfTwo(size);
+	buffers.push_back({allocate(capacity), capacity, true});
+	allocated++;
+	DLOG(INFO) << "Allocated pooled buffer of " << capacity << " B";
+	return buffers.back().data;
+}
+
+void BufferPool::release(unsigned char *data)
+{
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	for (auto &buffer : buffers)
+	{
+		if (buffer.data == data)
+		{
+			buffer.in_use = false;
+			return;
+		}
+	}
+	LOG(FATAL) << "Released buffer does not belong to the pool";
+}
+
+#ifdef _WIN32
+// Large pages need SeLockMemoryPrivilege on Windows, so only regular pages are used here
+unsigned char *BufferPool::allocate(std::size_t capacity)
+{
+	void *data = VirtualAlloc(nullptr, capacity, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (data == nullptr) LOG(FATAL) << "Unable to allocate " << capacity << " B transfer buffer";
+	if (huge_pages) DLOG(WARNING) << "Huge pages are not supported on Windows. Using regular pages";
+	if (lock_pages && !VirtualLock(data, capacity))
+	{
+		LOG(WARNING) << "Unable to lock " << capacity << " B transfer buffer in memory";
+	}
+	unsigned char *bytes = static_cast<unsigned char *>(data);
+	for (std::size_t offset = 0; offset < capacity; offset += BUFFER_PAGE_SIZE)
+	{
+		bytes[offset] = 0;
+	}
+	return bytes;
+}
+
+void BufferPool::deallocate(const Buffer &buffer)
+{
+	if (lock_pages) VirtualUnlock(buffer.data, buffer.capacity);
+	VirtualFree(buffer.data, 0, MEM_RELEASE);
+}
+
+std::size_t BufferPool::peakResidentBytes()
+{
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+}
+#else
+unsigned char *BufferPool::allocate(std::size_t capacity)
+{
+	void *data = MAP_FAILED;
+	if (huge_pages && capacity >= BUFFER_HUGE_PAGE_SIZE)
+	{
+#ifdef MAP_HUGETLB
+		data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+		if (data == MAP_FAILED)
+		{
+			DLOG(WARNING) << "No reserved huge pages for " << capacity << " B. Falling back to THP";
+		}
+	}
+	if (data == MAP_FAILED)
+	{
+		data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (data == MAP_FAILED) LOG(FATAL) << "Unable to allocate " << capacity << " B transfer buffer";
+#ifdef MADV_HUGEPAGE
+		if (huge_pages && capacity >= BUFFER_HUGE_PAGE_SIZE) madvise(data, capacity, MADV_HUGEPAGE);
+#endif
+	}
+	if (lock_pages && mlock(data, capacity) != 0)
+	{
+		LOG(WARNING) << "Unable to lock " << capacity << " B transfer buffer in memory. Check RLIMIT_MEMLOCK";
+	}
+
+	// Touching every page maps it now instead of inside the first timed transfer
+	unsigned char *bytes = static_cast<unsigned char *>(data);
+	for (std::size_t offset = 0; offset < capacity; offset += BUFFER_PAGE_SIZE)
+	{
+		bytes[offset] = 0;
+	}
+	return bytes;
+}
+
+void BufferPool::deallocate(const Buffer &buffer)
+{
+	munmap(buffer.data, buffer.capacity);
+}
+
+std::size_t BufferPool::peakResidentBytes()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+	return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+#endif
@@ -1,29 +1,5 @@
 #include "performance.h"
 
-void Configurations::writeHeadersToResultFile()
-{
-	std::fstream result_file;
-	result_file.open(results_path, std::ios::out | std::ios::app);
-	if (result_file.good())
-	{
-		for (std::vector<std::string>::iterator it = headers_v.begin();
-			 it != headers_v.end(); ++it)
-		{
-			if (it != headers_v.end()-1)
-				result_file << *it << result_sep;
-			else
-				result_file << *it;
-		}
-		result_file << std::endl;
-		result_file.close();
-		LOG(INFO) << "Headers have been written to: " << results_path;
-	}
-	else
-	{
-		LOG(FATAL) << "Unable to open " << results_path;
-	}
-}
-
 template <class T>
 void Configurations::vectorParser (std::vector<T> &parse_v, std::vector<T> &default_v, 
 								   const libconfig::Setting &setting, const char *option)
@@ -72,6 +48,14 @@ void Configurations::integerParams(const libconfig::Setting &params)
 				   << "Setting default value: 1";
 	}
 
+	warmup_iterations = 0;
+	params.lookupValue("warmup_iterations", warmup_iterations);
+	LOG(INFO) << "Warm-up iterations: " << warmup_iterations;
+
+	calibration_samples = 1000;
+	params.lookupValue("calibration_samples", calibration_samples);
+	LOG(INFO) << "Control overhead calibration samples: " << calibration_samples;
+
 	statistic_iter = params["statistic_iter"];
 	if (statistic_iter <= 0)
 	{
@@ -79,6 +63,120 @@ void Configurations::integerParams(const libconfig::Setting &params)
 		LOG(ERROR) << "Statistic iterations must be greater than 0. "
 				   << "Setting default value: 1";
 	}
+	ci_target = 0.0;
+	params.lookupValue("ci_target", ci_target);
+	min_statistic_iter = 3;
+	params.lookupValue("min_statistic_iter", min_statistic_iter);
+	if (min_statistic_iter < 2)
+	{
+		min_statistic_iter = 2;
+		LOG(ERROR) << "A confidence interval needs at least 2 statistic iterations. Setting value: 2";
+	}
+	if (ci_target > 0.0)
+	{
+		LOG(INFO) << "Statistic iterations: " << min_statistic_iter << " to " << statistic_iter
+				  << ", until the relative CI95 of PC and FPGA speed is below " << ci_target;
+	}
+
+	read_buffers = 1;
+	params.lookupValue("read_buffers", read_buffers);
+	if (read_buffers == 0)
+	{
+		read_buffers = 1;
+		LOG(ERROR) << "Read buffers must be greater than 0. "
+				   << "Setting default value: 1";
+	}
+	LOG(INFO) << "Read buffers: " << read_buffers;
+
+	pattern_cache_size = 1024;
+	params.lookupValue("pattern_cache_size", pattern_cache_size);
+	LOG(INFO) << "Pattern cache size: " << pattern_cache_size << " MB";
+
+	verify_threads = 0;
+	params.lookupValue("verify_threads", verify_threads);
+	if (verify_threads == 0)
+	{
+		verify_threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	LOG(INFO) << "Verification threads: " << verify_threads;
+
+	buffer_huge_pages = false;
+	params.lookupValue("buffer_huge_pages", buffer_huge_pages);
+	buffer_lock = false;
+	params.lookupValue("buffer_lock", buffer_lock);
+	LOG(INFO) << "Transfer buffers: huge pages " << buffer_huge_pages << ", locked " << buffer_lock;
+
+	sweep_mode = "grid";
+	params.lookupValue("sweep_mode", sweep_mode);
+	if (sweep_mode != "grid" && sweep_mode != "adaptive")
+	{
+		LOG(FATAL) << sweep_mode << " <- is not a valid parameter for sweep_mode option!";
+	}
+	if (sweep_mode == "adaptive" && resume)
+	{
+		LOG(FATAL) << "Resuming is not supported for the adaptive sweep";
+	}
+	adaptive_tolerance = 0.05;
+	params.lookupValue("adaptive_tolerance", adaptive_tolerance);
+	if (adaptive_tolerance <= 0.0 || adaptive_tolerance >= 1.0)
+	{
+		adaptive_tolerance = 0.05;
+		LOG(ERROR) << "Adaptive tolerance must be between 0 and 1. Setting default value: 0.05";
+	}
+	LOG(INFO) << "Sweep mode: " << sweep_mode << " (plateau tolerance " << adaptive_tolerance << ")";
+
+	transfer_chunk_size = 0;
+	params.lookupValue("transfer_chunk_size", transfer_chunk_size);
+	transfer_block_size = 0;
+	params.lookupValue("transfer_block_size", transfer_block_size);
+	if (transfer_chunk_size % 16 != 0)
+	{
+		LOG(FATAL) << transfer_chunk_size << " <- transfer_chunk_size must be a multiple of 16!";
+	}
+	if (transfer_block_size % 16 != 0 || transfer_block_size > 16384)
+	{
+		LOG(FATAL) << transfer_block_size << " <- transfer_block_size must be a multiple of 16 and <= 16384!";
+	}
+	if (transfer_block_size > 0 && transfer_chunk_size % transfer_block_size != 0)
+	{
+		LOG(FATAL) << transfer_chunk_size << " <- transfer_chunk_size must be a whole number of "
+				   << transfer_block_size << " B pipe blocks!";
+	}
+	autotune_chunks = false;
+	params.lookupValue("autotune_chunks", autotune_chunks);
+	LOG(INFO) << "Transfer chunk size: " << transfer_chunk_size << " B, pipe block size: "
+			  << transfer_block_size << " B, auto-tune: " << autotune_chunks;
+
+	write_mode = "repeat";
+	params.lookupValue("write_mode", write_mode);
+	if (write_mode != "repeat" && write_mode != "streaming")
+	{
+		LOG(FATAL) << write_mode << " <- is not a valid parameter for write_mode option!";
+	}
+	write_buffers = 4;
+	params.lookupValue("write_buffers", write_buffers);
+	if (write_buffers < 2)
+	{
+		write_buffers = 2;
+		LOG(ERROR) << "Streaming write needs at least 2 buffers. Setting value: 2";
+	}
+	LOG(INFO) << "Write mode: " << write_mode << " (" << write_buffers << " buffers)";
+
+	duplex_mode = "lockstep";
+	params.lookupValue("duplex_mode", duplex_mode);
+	if (duplex_mode != "lockstep" && duplex_mode != "streaming")
+	{
+		LOG(FATAL) << duplex_mode << " <- is not a valid parameter for duplex_mode option!";
+	}
+	duplex_in_flight = 4;
+	params.lookupValue("duplex_in_flight", duplex_in_flight);
+	if (duplex_in_flight == 0)
+	{
+		duplex_in_flight = 1;
+		LOG(ERROR) << "Duplex blocks in flight must be greater than 0. "
+				   << "Setting default value: 1";
+	}
+	LOG(INFO) << "Duplex mode: " << duplex_mode << " (" << duplex_in_flight << " blocks in flight)";
 }
 
 void Configurations::configureParams(libconfig::Config &cfg)
@@ -109,6 +207,119 @@ void Configurations::configureParams(libconfig::Config &cfg)
 	integerParams(params);
 }
 
+void Configurations::configureFifoModel(const libconfig::Setting &emulator,
+										const std::string &memory)
+{
+	FifoModel &model = emulator_settings.fifo_models[memory];
+	if (emulator.exists(memory))
+	{
+		const libconfig::Setting &fifo = emulator[memory.c_str()];
+		fifo.lookupValue("bandwidth", model.bandwidth);
+		fifo.lookupValue("half_rate_depth", model.half_rate_depth);
+	}
+	if (model.bandwidth <= 0 || model.half_rate_depth < 0)
+	{
+		LOG(FATAL) << "Invalid emulator model for " << memory << " FIFO memory";
+	}
+	DLOG(INFO) << "Emulator model for " << memory << ": " << model.bandwidth << " MB/s, "
+			   << "half rate at depth " << model.half_rate_depth;
+}
+
+void Configurations::configureEmulator(libconfig::Config &cfg)
+{
+	emulator_settings.realtime = false;
+	emulator_settings.control_latency = 30.0;
+	emulator_settings.pipe_latency = 60.0;
+	emulator_settings.fifo_models["blockram"] = {340.0, 16.0};
+	emulator_settings.fifo_models["distributedram"] = {330.0, 16.0};
+	emulator_settings.fifo_models["shiftregister"] = {300.0, 32.0};
+
+	if (!cfg.exists("emulator"))
+	{
+		LOG(WARNING) << "No 'emulator' scope in config file. Using default emulator model";
+		return;
+	}
+	try
+	{
+		const libconfig::Setting &emulator = cfg.lookup("emulator");
+		emulator.lookupValue("realtime", emulator_settings.realtime);
+		emulator.lookupValue("control_latency", emulator_settings.control_latency);
+		emulator.lookupValue("pipe_latency", emulator_settings.pipe_latency);
+		for (const auto &memory : memory_default)
+		{
+			configureFifoModel(emulator, memory);
+		}
+	}
+	catch (const libconfig::SettingTypeException &stexp)
+	{
+		LOG(FATAL) << "Setting type exception caught at: " << stexp.getPath();
+	}
+	LOG(INFO) << "Emulator model configured (realtime: " << emulator_settings.realtime << ")";
+}
+
+void Configurations::configureDevice(libconfig::Config &cfg)
+{
+	device_type = "frontpanel";
+	if (cfg.exists("device"))
+	{
+		const libconfig::Setting &device = cfg.lookup("device");
+		device.lookupValue("type", device_type);
+		if (device.exists("serials"))
+		{
+			for (auto i=0; i<device["serials"].getLength(); i++)
+			{
+				std::string serial = device["serials"][i].c_str();
+				if (std::find(device_serials.begin(), device_serials.end(), serial) != device_serials.end())
+				{
+					LOG(FATAL) << serial << " <- is listed twice in serials option!";
+				}
+				device_serials.push_back(serial);
+			}
+		}
+	}
+	if (device_serials.empty())
+	{
+		device_serials.push_back("");
+		LOG(INFO) << "No device serials. Using the first available device";
+	}
+	else
+	{
+		LOG(INFO) << "Test plan split across " << device_serials.size() << " devices";
+	}
+	if (device_type != "frontpanel" && device_type != "emulator")
+	{
+		LOG(FATAL) << device_type << " <- is not a valid device type!";
+	}
+	LOG(INFO) << "Device type set to: " << device_type;
+
+	// The emulator model is also the dry-run throughput estimate where no results exist
+	if (device_type == "emulator" || dry_run) configureEmulator(cfg);
+}
+
+void Configurations::configureEstimate(libconfig::Config &cfg)
+{
+	bitfile_load_time = 2.0;
+	if (cfg.exists("estimate"))
+	{
+		const libconfig::Setting &estimate = cfg.lookup("estimate");
+		if (estimate.exists("results"))
+		{
+			for (auto i=0; i<estimate["results"].getLength(); i++)
+			{
+				estimate_results_v.push_back(estimate["results"][i].c_str());
+			}
+		}
+		estimate.lookupValue("bitfile_load_time", bitfile_load_time);
+	}
+	if (estimate_results_v.empty()) estimate_results_v.push_back(results_path);
+	if (device_type == "emulator") bitfile_load_time = 0.0;
+	if (bitfile_load_time < 0.0)
+	{
+		LOG(FATAL) << bitfile_load_time << " <- is not a valid bitfile_load_time!";
+	}
+	DLOG(INFO) << "Bitfile load time for estimates: " << bitfile_load_time << " s";
+}
+
 void Configurations::configureOutputParameters(const libconfig::Setting &output)
 {
 	vectorParser(headers_v, headers_default, output, "headers");
@@ -127,6 +338,63 @@ void Configurations::configureOutputParameters(const libconfig::Setting &output)
 
 	result_sep = output["result_sep"].c_str();
 	LOG(INFO) << "Separator in results file set to: " << result_sep;
+
+	result_format = "csv";
+	output.lookupValue("result_format", result_format);
+	if (result_format != "csv" && result_format != "jsonl" && result_format != "binary")
+	{
+		LOG(FATAL) << result_format << " <- is not a valid parameter for result_format option!";
+	}
+	LOG(INFO) << "Results format: " << result_format;
+
+	resume = false;
+	output.lookupValue("resume", resume);
+	if (resume && result_format != "csv")
+	{
+		LOG(FATAL) << "Resuming is only supported for the csv result format";
+	}
+	LOG(INFO) << "Resume from existing results: " << resume;
+
+	std::string tuning_name = "chunk_tuning.csv";
+	output.lookupValue("chunk_tuning_name", tuning_name);
+	chunk_tuning_path = output["results_path"].c_str() + tuning_name;
+	LOG(INFO) << "Tuned transfer chunk sizes are kept in: " << chunk_tuning_path;
+
+	std::string knee_name = "knee_sizes.csv";
+	output.lookupValue("knee_report_name", knee_name);
+	knee_report_path = output["results_path"].c_str() + knee_name;
+	LOG(INFO) << "Adaptive sweep knee sizes will be saved in: " << knee_report_path;
+
+	std::string error_report_name = "error_reports.jsonl";
+	output.lookupValue("error_report_name", error_report_name);
+	if (!error_report_name.empty())
+	{
+		error_report_path = output["results_path"].c_str() + error_report_name;
+		LOG(INFO) << "Error reports will be saved in: " << error_report_path;
+	}
+	error_report_memory = 64;
+	output.lookupValue("error_report_memory", error_report_memory);
+	LOG(INFO) << "Error report memory per results row: " << error_report_memory << " KB";
+
+	phase_timing = false;
+	output.lookupValue("phase_timing", phase_timing);
+	std::string trace_name;
+	output.lookupValue("trace_name", trace_name);
+	if (!trace_name.empty())
+	{
+		trace_path = output["results_path"].c_str() + trace_name;
+		phase_timing = true;
+		LOG(INFO) << "Timeline trace will be saved in: " << trace_path;
+	}
+	LOG(INFO) << "Phase timing: " << phase_timing;
+
+	std::string histogram_name;
+	output.lookupValue("latency_histogram_name", histogram_name);
+	if (!histogram_name.empty())
+	{
+		latency_histogram_path = output["results_path"].c_str() + histogram_name;
+		LOG(INFO) << "Duplex latency histograms will be saved in: " << latency_histogram_path;
+	}
 }
 
 void Configurations::configureOutputBitfiles(libconfig::Config &cfg)
@@ -0,0 +1,175 @@
+#include "performance.h"
+
+// Nothing on the FPGA is known after a bitfile load or FPGA reset
+void ControlQueue::forgetDeviceState()
+{
+	wire_ins_set.clear();
+	wire_ins_requested.clear();
+	wire_ins_sent.clear();
+	update_requested = false;
+	wire_outs_latched = false;
+	timer_stopped = false;
+	pattern_reset = false;
+}
+
+// Sends the wire-ins requested by UpdateWireIns, if any of them differ from the FPGA
+void ControlQueue::flushWireIns()
+{
+	if (!update_requested) return;
+	update_requested = false;
+	bool changed = false;
+	for (const auto &wire : wire_ins_requested)
+	{
+		auto sent = wire_ins_sent.find(wire.first);
+		if (sent == wire_ins_sent.end() || sent->second != wire.second) changed = true;
+	}
+	if (!changed)
+	{
+		elided++;
+		return;
+	}
+
+	for (const auto &wire : wire_ins_requested)
+	{
+		dev->SetWireInValue(wire.first, wire.second);
+		wire_ins_sent[wire.first] = wire.second;
+	}
+	dev->UpdateWireIns();
+	round_trips++;
+	// The pattern wire is sampled on RESET_PATTERN, and a new value needs a new reset
+	pattern_reset = false;
+}
+
+void ControlQueue::beforePipeCall()
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	flushWireIns();
+	wire_outs_latched = false;
+	pattern_reset = false;
+}
+
+bool ControlQueue::IsOpen()
+{
+	return dev->IsOpen();
+}
+
+bool ControlQueue::IsEmulated()
+{
+	return dev->IsEmulated();
+}
+
+okCFrontPanel::ErrorCode ControlQueue::OpenBySerial(const std::string &serial)
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	forgetDeviceState();
+	return dev->OpenBySerial(serial);
+}
+
+okCFrontPanel::ErrorCode ControlQueue::ResetFPGA()
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	forgetDeviceState();
+	return dev->ResetFPGA();
+}
+
+okCFrontPanel::ErrorCode ControlQueue::ConfigureFPGA(const std::string &path_to_bitfile)
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	forgetDeviceState();
+	return dev->ConfigureFPGA(path_to_bitfile);
+}
+
+std::string ControlQueue::GetErrorString(int err_code)
+{
+	return dev->GetErrorString(err_code);
+}
+
+void ControlQueue::SetWireInValue(int ep_addr, unsigned int value)
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	wire_ins_set[ep_addr] = value;
+}
+
+// Deferred until a trigger or pipe call could see the new values
+void ControlQueue::UpdateWireIns()
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	for (const auto &wire : wire_ins_set)
+	{
+		wire_ins_requested[wire.first] = wire.second;
+	}
+	update_requested = true;
+}
+
+// The latched values stay current while the timer is stopped and no trigger or data reached the FPGA
+void ControlQueue::UpdateWireOuts()
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	if (wire_outs_latched && timer_stopped)
+	{
+		elided++;
+		return;
+	}
+	flushWireIns();
+	dev->UpdateWireOuts();
+	round_trips++;
+	wire_outs_latched = true;
+}
+
+unsigned int ControlQueue::GetWireOutValue(int ep_addr)
+{
+	return dev->GetWireOutValue(ep_addr);
+}
+
+void ControlQueue::ActivateTriggerIn(int ep_addr, int bit)
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	flushWireIns();
+	if (ep_addr == TRIGGER && bit == RESET_PATTERN && pattern_reset)
+	{
+		elided++;
+		return;
+	}
+	dev->ActivateTriggerIn(ep_addr, bit);
+	round_trips++;
+	wire_outs_latched = false;
+
+	if (ep_addr != TRIGGER)
+	{
+		pattern_reset = false;
+		return;
+	}
+	// RESET also flushes the read FIFO, which the generator then refills from where it stopped.
+	// The read generator fills the FIFO while the timer runs, so START_TIMER ends a pattern reset too
+	if (bit == START_TIMER || bit == STOP_TIMER || bit == RESET) timer_stopped = (bit != START_TIMER);
+	if (bit != STOP_TIMER) pattern_reset = (bit == RESET_PATTERN);
+}
+
+long ControlQueue::WriteToPipeIn(int ep_addr, long length, unsigned char *data)
+{
+	beforePipeCall();
+	return dev->WriteToPipeIn(ep_addr, length, data);
+}
+
+long ControlQueue::ReadFromPipeOut(int ep_addr, long length, unsigned char *data)
+{
+	beforePipeCall();
+	return dev->ReadFromPipeOut(ep_addr, length, data);
+}
+
+long ControlQueue::WriteToBlockPipeIn(int ep_addr, int block_size, long length, unsigned char *data)
+{
+	beforePipeCall();
+	return dev->WriteToBlockPipeIn(ep_addr, block_size, length, data);
+}
+
+long ControlQueue::ReadFromBlockPipeOut(int ep_addr, int block_size, long length, unsigned char *data)
+{
+	beforePipeCall();
+	return dev->ReadFromBlockPipeOut(ep_addr, block_size, length, data);
+}
+
+std::string ControlQueue::GetSerialNumber()
+{
+	return dev->GetSerialNumber();
+}
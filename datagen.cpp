@@ -1,4 +1,6 @@
 #include "performance.h"
+#include <algorithm>
+#include <cstring>
 
 void DataGenerator::performActionOnGeneratedData(const unsigned char &data_char, unsigned int index)
 {
@@ -12,51 +14,126 @@ void DataGenerator::performActionOnGeneratedData(const unsigned char &data_char,
 	}
 }
 
-void DataGenerator::asic()
+namespace
 {
-	uint16_t amplitude = 0x123; // 16b
-	uint64_t timestamp = 0; // 36b
-
-	const uint8_t max_id = 15; // 4b
-	const uint8_t max_channel = 255; // 8b
-	const uint16_t max_amplitude = 65535; // 16b
-	const uint64_t max_timestamp = 68719476735; // 36b
+	// Event layout of dataGenerator.v: {timestamp[35:0], amplitude[15:0], channel[7:0], id[3:0]}
+	constexpr uint64_t ASIC_ID_MASK        {0xFULL};
+	constexpr uint64_t ASIC_CHANNEL_MASK   {0xFFULL << 4};
+	constexpr uint64_t ASIC_AMPLITUDE_MASK {0xFFFFULL << 12};
+	constexpr uint64_t ASIC_TIMESTAMP_MASK {0xFFFFFFFFFULL << 28};
+	constexpr uint8_t  ASIC_MAX_ID         {15};
+	constexpr uint8_t  ASIC_MAX_CHANNEL    {255};
 
-	unsigned char asic_data[8];
+	inline uint64_t packAsicEvent(uint8_t id, uint8_t channel, uint16_t amplitude, uint64_t timestamp)
+	{
+		return (timestamp << 28) | (static_cast<uint64_t>(amplitude) << 12) |
+			   (static_cast<uint64_t>(channel) << 4) | id;
+	}
 
-	uint8_t id = 1;
-	uint8_t channel = 1;
-	unsigned int i_data = 0;
+	inline unsigned int countNonZeroBytes(uint64_t x)
+	{
+		unsigned int count = 0;
+		for (; x; x >>= 8)
+		{
+			if (x & 0xFF) count++;
+		}
+		return count;
+	}
 
-	while (i_data < pattern_size)
+	// Amplitude of every event: the LFSR x^12 + x^6 + x^4 from 0x123 until its state repeats.
+	// Events past the end continue at cycle_start
+	struct AmplitudeTable
 	{
-		timestamp = i_data + 1; // TODO: Do with something better than that
-		asic_data[0] = static_cast<unsigned char>(id);
-		asic_data[0] += static_cast<unsigned char>(channel << 4); // ID and half of channel
+		std::vector<uint16_t> values;
+		std::size_t cycle_start;
 
-		asic_data[1] = static_cast<unsigned char>(channel >> 4);
-		asic_data[1] += static_cast<unsigned char>(amplitude << 4); // second half of CHANNEL and 1/4 of AMPLITUDE
+		AmplitudeTable()
+		{
+			std::vector<int> first_seen(65536, -1);
+			uint16_t amplitude = 0x123;
+			while (first_seen[amplitude] < 0)
+			{
+				first_seen[amplitude] = static_cast<int>(values.size());
+				values.push_back(amplitude);
+				amplitude = (amplitude << 1) | (((amplitude >> 11) ^ (amplitude >> 5) ^ (amplitude >> 3)) & 1);
+			}
+			cycle_start = first_seen[amplitude];
+		}
 
-		asic_data[2] = static_cast<unsigned char>(amplitude >> 4); // 1/2 of AMPLITUDE
+		std::size_t indexOf(uint64_t event) const
+		{
+			if (event < values.size()) return event;
+			const std::size_t period = values.size() - cycle_start;
+			return cycle_start + (event - cycle_start) % period;
+		}
+	};
 
-		asic_data[3] = static_cast<unsigned char>(amplitude >> 12);
-		asic_data[3] += static_cast<unsigned char>(timestamp << 4); // 1/4 of AMPLITUDE and 1/9 of TIMESTAMP
+	const AmplitudeTable &amplitudeTable()
+	{
+		static const AmplitudeTable table;
+		return table;
+	}
+}
 
-		asic_data[4] = static_cast<unsigned char>(timestamp >> 4);  // 2/9 of TIMESTAMP
-		asic_data[5] = static_cast<unsigned char>(timestamp >> 12); // 2/9 of TIMESTAMP
-		asic_data[6] = static_cast<unsigned char>(timestamp >> 20); // 2/9 of TIMESTAMP
-		asic_data[7] = static_cast<unsigned char>(timestamp >> 28); // 2/9 of TIMESTAMP
+DataGenerator::AsicState DataGenerator::asicStateAt(uint64_t offset)
+{
+	const uint64_t event = offset / 8;
+	AsicState state;
+	state.channel = static_cast<uint8_t>(1 + event % ASIC_MAX_CHANNEL);
+	state.id = static_cast<uint8_t>(1 + (event / ASIC_MAX_CHANNEL) % (ASIC_MAX_ID - 1));
+	state.amplitude = amplitudeTable().values[amplitudeTable().indexOf(event)];
+	// dataGenerator.v only steps the timestamp when it reaches 36'hFFFFFFFFF, so it stays at its reset value
+	state.timestamp = 1;
+	return state;
+}
 
-		amplitude = (amplitude << 1) | ((((amplitude >> 11)^(amplitude >> 5)^(amplitude >> 3)) & 1)); // {amplitude[15:0], amplitude[11] ^ amplitude[5] ^ amplitude[3]}; so: x^12 + x^6 + x^4
+// Whole 64-bit events, generated from the amplitude table and compared field by field
+void DataGenerator::asic()
+{
+	if (offset % 8 != 0)
+	{
+		LOG(FATAL) << "ASIC pattern can only be generated from an event boundary";
+	}
+	const AmplitudeTable &table = amplitudeTable();
+	AsicState state = asicStateAt(offset);
+	std::size_t amplitude_index = table.indexOf(offset / 8);
+	uint8_t id = state.id;
+	uint8_t channel = state.channel;
 
-		for (std::size_t i = 0; i < sizeof(asic_data); i++)
+	for (unsigned int i_data = 0; i_data < pattern_size; i_data += 8)
+	{
+		const uint64_t expected = packAsicEvent(id, channel, table.values[amplitude_index], state.timestamp);
+		if (i_data + 8 <= pattern_size)
+		{
+			if (check_for_errors)
+			{
+				uint64_t received;
+				std::memcpy(&received, data + i_data, 8);
+				checkAsicEvent(received ^ expected);
+			}
+			else
+			{
+				std::memcpy(data + i_data, &expected, 8);
+			}
+		}
+		else
 		{
-			if (check_for_errors && i >= 3) break;
-			performActionOnGeneratedData(asic_data[i], i_data + i);
+			// Partial event at the end of the pattern
+			const unsigned int length = pattern_size - i_data;
+			uint64_t received = 0;
+			if (check_for_errors)
+			{
+				std::memcpy(&received, data + i_data, length);
+				checkAsicEvent((received ^ expected) & ((1ULL << length*8) - 1));
+			}
+			else
+			{
+				std::memcpy(data + i_data, &expected, length);
+			}
 		}
-		i_data += 8;
 
-		if (channel == max_channel)
+		if (++amplitude_index == table.values.size()) amplitude_index = table.cycle_start;
+		if (channel == ASIC_MAX_CHANNEL)
 		{
 			channel = 1;
 			++id;
@@ -65,54 +142,63 @@ void DataGenerator::asic()
 		{
 			++channel;
 		}
-		if (id == max_id)
+		if (id == ASIC_MAX_ID)
 		{
 			id = 1;
 		}
 	}
 }
 
-void DataGenerator::walking1()
+void DataGenerator::checkAsicEvent(uint64_t difference)
 {
-	uint64_t iter = 1;
-	uint64_t last_possible_value = max_register_size / 2 + 1;
-	for (unsigned int i=0; i < pattern_size; i+=register_size)
-	{
-		for (unsigned int j=0; j < register_size; j++)
-		{
-			unsigned char data_char = static_cast<unsigned char>((iter >> j*8) & 0xFF);
-			performActionOnGeneratedData(data_char, i+j);
-		}
-		
-		if (iter == last_possible_value) iter = 1;
-		else iter *= 2;
-	}
+	if (!difference) return;
+	errors += countNonZeroBytes(difference);
+	if (difference & ASIC_ID_MASK) asic_errors.id++;
+	if (difference & ASIC_CHANNEL_MASK) asic_errors.channel++;
+	if (difference & ASIC_AMPLITUDE_MASK) asic_errors.amplitude++;
+	if (difference & ASIC_TIMESTAMP_MASK) asic_errors.timestamp++;
 }
 
-void DataGenerator::counter32Bit()
+// 64 stream bits per step. A 32-bit register takes the upper half first, so the two words swap halves
+void DataGenerator::prbs()
 {
-	uint64_t iter = 0;
-	for (unsigned int i = 0; i < pattern_size; i+=register_size)
+	if (offset % register_size != 0)
 	{
-		for (unsigned int j = 0; j < register_size; j++)
-		{
-			unsigned char data_char = static_cast<unsigned char>((iter >> j*8) & 0xFF);
-			performActionOnGeneratedData(data_char, i+j);
-		}
-		if (iter > max_register_size) iter = 0;
-		else ++iter;
+		LOG(FATAL) << "PRBS pattern can only be generated from a register word boundary";
 	}
-}
-
-void DataGenerator::counter8Bit()
-{
-	uint64_t iter = 0;
-	for (unsigned int i = 0; i < pattern_size; i++)
+	PrbsGenerator generator(pattern, offset * 8);
+	for (unsigned int i_data = 0; i_data < pattern_size; i_data += 8)
 	{
-		unsigned char data_char = static_cast<unsigned char>(iter);
-		performActionOnGeneratedData(data_char, i);
-		if (iter > max_register_size) iter = 0;
-		else ++iter;
+		uint64_t expected = generator.next();
+		if (register_size == 4) expected = (expected << 32) | (expected >> 32);
+		const unsigned int length = std::min(8u, pattern_size - i_data);
+		if (length == 8)
+		{
+			if (check_for_errors)
+			{
+				uint64_t received;
+				std::memcpy(&received, data + i_data, 8);
+				errors += countNonZeroBytes(received ^ expected);
+			}
+			else
+			{
+				std::memcpy(data + i_data, &expected, 8);
+			}
+		}
+		else
+		{
+			// Partial word at the end of the pattern
+			uint64_t received = 0;
+			if (check_for_errors)
+			{
+				std::memcpy(&received, data + i_data, length);
+				errors += countNonZeroBytes((received ^ expected) & ((1ULL << length*8) - 1));
+			}
+			else
+			{
+				std::memcpy(data + i_data, &expected, length);
+			}
+		}
 	}
 }
 
@@ -140,23 +226,18 @@ void DataGenerator::determineRegisterParameters()
 void DataGenerator::generateData()
 {
 	determineRegisterParameters();
-	switch(pattern)
+	if (datakernels::supportsPattern(pattern))
 	{
-		case COUNTER_8BIT:
-			counter8Bit();
-			break;
-
-		case COUNTER_32BIT:
-			counter32Bit();
-			break;
-		
-		case WALKING_1:
-			walking1();
-			break;
-
-		case ASIC:
-			asic();
-			break;
+		if (check_for_errors) errors += datakernels::verify(pattern, register_size, data, pattern_size, offset);
+		else datakernels::fill(pattern, register_size, data, pattern_size, offset);
+	}
+	else if (pattern == ASIC)
+	{
+		asic();
+	}
+	else if (PrbsGenerator::isPrbs(pattern))
+	{
+		prbs();
 	}
 	DLOG(INFO) << "Data to write generated";
 }
@@ -174,4 +255,159 @@ unsigned int DataGenerator::checkArrayForErrors(unsigned char *data)
 	this->data = data;
 	generateData();
 	return errors;
+}
+
+// PATTERN CACHE
+void PatternCache::evictUntilFits(std::size_t size)
+{
+	while (!lru.empty() && used + size > capacity)
+	{
+		DLOG(INFO) << "Evicting cached pattern of " << lru.back().size << " B";
+		used -= lru.back().size;
+		index.erase(lru.back().key);
+		lru.pop_back();
+	}
+}
+
+std::shared_ptr<const unsigned char> PatternCache::getPattern(unsigned int mode, unsigned int pattern,
+															  unsigned int pattern_size)
+{
+	const Key key{mode, pattern, pattern_size};
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		auto it = index.find(key);
+		if (it != index.end())
+		{
+			lru.splice(lru.begin(), lru, it->second);
+			hits++;
+			return it->second->data;
+		}
+		misses++;
+		if (pattern_size > capacity) return nullptr;
+	}
+
+	std::shared_ptr<unsigned char> data(new unsigned char[pattern_size],
+										std::default_delete<unsigned char[]>());
+	{
+		TRACE_SCOPE("pattern generation");
+		DataGenerator datagen(mode, pattern, pattern_size);
+		datagen.fillArrayWithData(data.get());
+	}
+
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	auto it = index.find(key);
+	if (it != index.end()) return it->second->data;
+	evictUntilFits(pattern_size);
+	lru.push_front({key, data, pattern_size});
+	index[key] = lru.begin();
+	used += pattern_size;
+	return data;
+}
+
+// VERIFIER POOL
+constexpr unsigned int MIN_SHARD_SIZE {1 << 20};
+
+VerifierPool::VerifierPool(unsigned int threads)
+{
+	for (unsigned int t = 1; t < threads; t++)
+	{
+		workers.push_back(std::thread(&VerifierPool::runTasks, this));
+	}
+	DLOG(INFO) << "VerifierPool class initialized with " << threads << " threads";
+}
+
+VerifierPool::~VerifierPool()
+{
+	for (std::size_t t = 0; t < workers.size(); t++)
+	{
+		tasks.push(std::function<void()>());
+	}
+	for (auto &worker : workers)
+	{
+		worker.join();
+	}
+	DLOG(INFO) << "Destroying VerifierPool class";
+}
+
+void VerifierPool::runTasks()
+{
+	for (auto task = tasks.pop(); task; task = tasks.pop())
+	{
+		task();
+	}
+}
+
+unsigned int VerifierPool::verify(unsigned int mode, unsigned int pattern, unsigned char *data,
+								  unsigned int pattern_size, const unsigned char *golden,
+								  AsicFieldErrors *asic_errors, ErrorReport *report)
+{
+	std::mutex done_mutex;
+	auto verifyShard = [&, mode, pattern, data, golden](unsigned int shard_offset, unsigned int shard_size) -> unsigned int
+	{
+		if (golden && std::memcmp(data + shard_offset, golden + shard_offset, shard_size) == 0)
+		{
+			return 0;
+		}
+		DataGenerator datagen(mode, pattern, shard_size, shard_offset);
+		unsigned int shard_errors = datagen.checkArrayForErrors(data + shard_offset);
+		if (asic_errors)
+		{
+			std::lock_guard<std::mutex> lock(done_mutex);
+			*asic_errors += datagen.asic_errors;
+		}
+		if (report && shard_errors)
+		{
+			// The failing shard is compared again byte by byte to locate the mismatches
+			std::unique_ptr<unsigned char[]> generated;
+			const unsigned char *expected = golden ? golden + shard_offset : nullptr;
+			if (!expected)
+			{
+				generated.reset(new unsigned char[shard_size]);
+				DataGenerator(mode, pattern, shard_size, shard_offset).fillArrayWithData(generated.get());
+				expected = generated.get();
+			}
+			ErrorReport shard_report{report->maxBytes()};
+			shard_report.iteration = report->iteration;
+			shard_report.compare(data + shard_offset, expected, shard_size, shard_offset, mode == NONSYM ? 8 : 4);
+			std::lock_guard<std::mutex> lock(done_mutex);
+			report->merge(shard_report);
+		}
+		return shard_errors;
+	};
+
+	const unsigned int threads = workers.size() + 1;
+	if (threads == 1 || pattern_size < 2 * MIN_SHARD_SIZE)
+	{
+		return verifyShard(0, pattern_size);
+	}
+
+	// Shards start on 64 byte boundaries so every pattern word and ASIC event stays whole
+	unsigned int shards = std::min(threads, pattern_size / MIN_SHARD_SIZE);
+	unsigned int shard_size = (pattern_size / shards + 63) & ~63u;
+
+	std::condition_variable done_cv;
+	unsigned int pending = 0;
+	unsigned int errors = 0;
+	unsigned int first_shard_errors = 0;
+
+	for (unsigned int shard_offset = shard_size; shard_offset < pattern_size; shard_offset += shard_size)
+	{
+		unsigned int size = std::min(shard_size, pattern_size - shard_offset);
+		{
+			std::lock_guard<std::mutex> lock(done_mutex);
+			pending++;
+		}
+		tasks.push([&, shard_offset, size]
+		{
+			unsigned int shard_errors = verifyShard(shard_offset, size);
+			std::lock_guard<std::mutex> lock(done_mutex);
+			errors += shard_errors;
+			if (--pending == 0) done_cv.notify_one();
+		});
+	}
+	first_shard_errors = verifyShard(0, std::min(shard_size, pattern_size));
+
+	std::unique_lock<std::mutex> lock(done_mutex);
+	done_cv.wait(lock, [&]{ return pending == 0; });
+	return errors + first_shard_errors;
 }
\ No newline at end of file
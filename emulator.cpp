@@ -0,0 +1,408 @@
+#include "performance.h"
+#include <thread>
+
+// HDL PATTERN GENERATOR
+void HdlPatternGenerator::reset(unsigned int pattern)
+{
+	uint64_t mask = (register_size == 8) ? std::numeric_limits<uint64_t>::max() :
+										   std::numeric_limits<unsigned int>::max();
+	switch (pattern)
+	{
+		case COUNTER_8BIT:
+			dataout = 0;
+			for (unsigned int k = 0; k < register_size; k++)
+			{
+				uint64_t byte_value = static_cast<uint8_t>(k - register_size);
+				dataout |= byte_value << k*8;
+			}
+			break;
+
+		case COUNTER_32BIT:
+			dataout = mask;
+			break;
+
+		case WALKING_1:
+			dataout = static_cast<uint64_t>(1) << (register_size*8 - 1);
+			break;
+
+		case ASIC:
+			id = 1;
+			channel = 1;
+			amplitude = 0x123;
+			timestamp = 1;
+			break;
+
+		case PRBS7:
+		case PRBS15:
+		case PRBS23:
+		case PRBS31:
+			// No HDL generator yet: the model follows the software PRBS stream
+			prbs = PrbsGenerator(pattern);
+			break;
+	}
+}
+
+uint64_t HdlPatternGenerator::nextWord(unsigned int pattern)
+{
+	const unsigned int bits = register_size * 8;
+	uint64_t mask = (register_size == 8) ? std::numeric_limits<uint64_t>::max() :
+										   std::numeric_limits<unsigned int>::max();
+	switch (pattern)
+	{
+		case COUNTER_8BIT:
+		{
+			uint64_t next = 0;
+			for (unsigned int k = 0; k < register_size; k++)
+			{
+				uint64_t byte_value = static_cast<uint8_t>((dataout >> k*8) + register_size);
+				next |= byte_value << k*8;
+			}
+			dataout = next;
+			break;
+		}
+
+		case COUNTER_32BIT:
+			dataout = (dataout + 1) & mask;
+			break;
+
+		case WALKING_1:
+			dataout = ((dataout << 1) | (dataout >> (bits - 1))) & mask;
+			break;
+
+		case ASIC:
+			if (register_size != 8) break; // only nonsym generator knows this pattern
+			dataout = (timestamp << 28) | (static_cast<uint64_t>(amplitude) << 12) |
+					  (static_cast<uint64_t>(channel) << 4) | id;
+			amplitude = (amplitude << 1) | (((amplitude >> 11) ^ (amplitude >> 5) ^ (amplitude >> 3)) & 1);
+			if (timestamp == 0xFFFFFFFFF) timestamp += 1; // as in dataGenerator.v
+			if (channel == 0xFF)
+			{
+				channel = 1;
+				++id;
+			}
+			else
+			{
+				++channel;
+			}
+			if (id == 0xF) id = 1;
+			break;
+
+		case PRBS7:
+		case PRBS15:
+		case PRBS23:
+		case PRBS31:
+			dataout = prbs.nextWord(register_size);
+			break;
+	}
+	return dataout;
+}
+
+// EMULATED DEVICE
+void EmulatedDevice::resetState()
+{
+	wire_ins_pending.clear();
+	wire_ins.clear();
+	wire_outs.clear();
+	loopback.clear();
+	error_count = 0;
+	timer_on = false;
+	clk_counts = 0;
+	generator.reset(patternWire());
+	checker.reset(patternWire());
+}
+
+void EmulatedDevice::elapse(double duration_us)
+{
+	virtual_time += duration_us;
+	if (timer_on) clk_counts += duration_us * FIFO_CLOCK;
+}
+
+static void waitForModel(bool realtime, double duration_us)
+{
+	if (realtime)
+	{
+		std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(duration_us));
+	}
+}
+
+unsigned int EmulatedDevice::patternWire()
+{
+	return wire_ins[PATTERN_TO_GENERATE];
+}
+
+void EmulatedDevice::fillFromGenerator(long length, unsigned char *data)
+{
+	const unsigned int pattern = patternWire();
+	for (long i = 0; i < length; i += generator.register_size)
+	{
+		uint64_t word = generator.nextWord(pattern);
+		for (unsigned int k = 0; k < generator.register_size && i + k < length; k++)
+		{
+			data[i + k] = static_cast<unsigned char>(word >> k*8);
+		}
+	}
+}
+
+void EmulatedDevice::checkAgainstPattern(long length, unsigned char *data)
+{
+	const unsigned int pattern = patternWire();
+	const unsigned int register_size = checker.register_size;
+	for (long i = 0; i + static_cast<long>(register_size) <= length; i += register_size)
+	{
+		uint64_t received = 0;
+		for (unsigned int k = 0; k < register_size; k++)
+		{
+			received |= static_cast<uint64_t>(data[i + k]) << k*8;
+		}
+		uint64_t correct = checker.nextWord(pattern);
+		if (mode == NONSYM && pattern == ASIC)
+		{
+			// checkData.v compares only id, channel and amplitude
+			received &= 0xFFFFFFF;
+			correct &= 0xFFFFFFF;
+		}
+		if (received != correct) error_count += 1;
+	}
+}
+
+bool EmulatedDevice::IsOpen()
+{
+	std::lock_guard<std::mutex> lock(device_mutex);
+	return open;
+}
+
+bool EmulatedDevice::IsEmulated()
+{
+	return true;
+}
+
+okCFrontPanel::ErrorCode EmulatedDevice::OpenBySerial(const std::string &serial)
+{
+	std::lock_guard<std::mutex> lock(device_mutex);
+	open = true;
+	this->serial = serial.empty() ? "emulator" : serial;
+	DLOG(INFO) << "Emulated device opened (requested serial: '" << serial << "')";
+	return okCFrontPanel::NoError;
+}
+
+okCFrontPanel::ErrorCode EmulatedDevice::ResetFPGA()
+{
+	std::lock_guard<std::mutex> lock(device_mutex);
+	if (!open) return okCFrontPanel::DeviceNotOpen;
+	resetState();
+	return okCFrontPanel::NoError;
+}
+
+okCFrontPanel::ErrorCode EmulatedDevice::ConfigureFPGA(const std::string &path_to_bitfile)
+{
+	static const std::regex bitfile_regex{"(read|write|bidir)_(32bit|nonsym|duplex)_fifo_"
+										  "([a-z]+)_([0-9]+)\\.bit$"};
+	std::lock_guard<std::mutex> lock(device_mutex);
+	if (!open) return okCFrontPanel::DeviceNotOpen;
+
+	std::smatch match;
+	if (!std::regex_search(path_to_bitfile, match, bitfile_regex))
+	{
+		LOG(ERROR) << "Emulator cannot derive FIFO parameters from " << path_to_bitfile;
+		return okCFrontPanel::InvalidBitstream;
+	}
+	auto fifo_model = settings.fifo_models.find(match[3]);
+	if (fifo_model == settings.fifo_models.end())
+	{
+		LOG(ERROR) << "No emulator model for FIFO memory " << match[3];
+		return okCFrontPanel::InvalidBitstream;
+	}
+
+	if (match[2] == "32bit") mode = BIT32;
+	else if (match[2] == "nonsym") mode = NONSYM;
+	else mode = DUPLEX;
+	direction = (match[1] == "write") ? WRITE : READ;
+	depth = std::stoul(match[4]);
+	this->fifo_model = fifo_model->second;
+
+	generator.register_size = (mode == NONSYM) ? 8 : 4;
+	checker.register_size = generator.register_size;
+	configured = true;
+	resetState();
+	DLOG(INFO) << "Emulator configured as " << match[0];
+	return okCFrontPanel::NoError;
+}
+
+std::string EmulatedDevice::GetErrorString(int err_code)
+{
+	switch (err_code)
+	{
+		case okCFrontPanel::NoError:          return "NoError";
+		case okCFrontPanel::DeviceNotOpen:    return "DeviceNotOpen";
+		case okCFrontPanel::InvalidBitstream: return "InvalidBitstream";
+		case okCFrontPanel::InvalidEndpoint:  return "InvalidEndpoint";
+		default:                              return "Failed";
+	}
+}
+
+void EmulatedDevice::SetWireInValue(int ep_addr, unsigned int value)
+{
+	std::lock_guard<std::mutex> lock(device_mutex);
+	wire_ins_pending[ep_addr] = value;
+}
+
+void EmulatedDevice::UpdateWireIns()
+{
+	{
+		std::lock_guard<std::mutex> lock(device_mutex);
+		elapse(settings.control_latency);
+		for (const auto &wire : wire_ins_pending)
+		{
+			wire_ins[wire.first] = wire.second;
+		}
+	}
+	waitForModel(settings.realtime, settings.control_latency);
+}
+
+void EmulatedDevice::UpdateWireOuts()
+{
+	{
+		std::lock_guard<std::mutex> lock(device_mutex);
+		elapse(settings.control_latency);
+		uint64_t counts = static_cast<uint64_t>(clk_counts);
+		wire_outs[NUMBER_OF_COUNTS_A] = static_cast<unsigned int>(counts);
+		wire_outs[NUMBER_OF_COUNTS_B] = static_cast<unsigned int>(counts >> 32);
+		wire_outs[ERROR_COUNT] = error_count;
+	}
+	waitForModel(settings.realtime, settings.control_latency);
+}
+
+unsigned int EmulatedDevice::GetWireOutValue(int ep_addr)
+{
+	std::lock_guard<std::mutex> lock(device_mutex);
+	return wire_outs[ep_addr];
+}
+
+void EmulatedDevice::ActivateTriggerIn(int ep_addr, int bit)
+{
+	{
+		std::lock_guard<std::mutex> lock(device_mutex);
+		elapse(settings.control_latency);
+		if (ep_addr != TRIGGER) return;
+		switch (bit)
+		{
+			case RESET:
+				clk_counts = 0;
+				timer_on = false;
+				error_count = 0;
+				loopback.clear();
+				break;
+
+			case START_TIMER:
+				timer_on = true;
+				clk_counts += 1;
+				break;
+
+			case STOP_TIMER:
+				timer_on = false;
+				break;
+
+			case RESET_PATTERN:
+				generator.reset(patternWire());
+				checker.reset(patternWire());
+				break;
+		}
+	}
+	waitForModel(settings.realtime, settings.control_latency);
+}
+
+long EmulatedDevice::WriteToPipeIn(int ep_addr, long length, unsigned char *data)
+{
+	double duration_us;
+	{
+		std::lock_guard<std::mutex> lock(device_mutex);
+		if (!configured) return okCFrontPanel::DeviceNotOpen;
+		if (ep_addr != PIPE_IN || (mode != DUPLEX && direction != WRITE))
+		{
+			return okCFrontPanel::InvalidEndpoint;
+		}
+
+		double bandwidth = fifo_model.bandwidth * depth / (depth + fifo_model.half_rate_depth);
+		duration_us = settings.pipe_latency + length / bandwidth;
+		elapse(duration_us);
+
+		if (mode == DUPLEX)
+		{
+			// Words which do not fit into the FIFO are lost, as with a real okPipeIn
+			std::size_t capacity = static_cast<std::size_t>(depth) * 4;
+			for (long i = 0; i < length && loopback.size() < capacity; i++)
+			{
+				loopback.push_back(data[i]);
+			}
+		}
+		else
+		{
+			checkAgainstPattern(length, data);
+		}
+	}
+	waitForModel(settings.realtime, duration_us);
+	return length;
+}
+
+long EmulatedDevice::ReadFromPipeOut(int ep_addr, long length, unsigned char *data)
+{
+	double duration_us;
+	{
+		std::lock_guard<std::mutex> lock(device_mutex);
+		if (!configured) return okCFrontPanel::DeviceNotOpen;
+		if (ep_addr != PIPE_OUT || (mode != DUPLEX && direction != READ))
+		{
+			return okCFrontPanel::InvalidEndpoint;
+		}
+
+		double bandwidth = fifo_model.bandwidth * depth / (depth + fifo_model.half_rate_depth);
+		duration_us = settings.pipe_latency + length / bandwidth;
+		elapse(duration_us);
+
+		if (mode == DUPLEX)
+		{
+			for (long i = 0; i < length; i++)
+			{
+				if (loopback.empty())
+				{
+					data[i] = 0;
+				}
+				else
+				{
+					data[i] = loopback.front();
+					loopback.pop_front();
+				}
+			}
+		}
+		else
+		{
+			fillFromGenerator(length, data);
+		}
+	}
+	waitForModel(settings.realtime, duration_us);
+	return length;
+}
+
+// Block-throttled pipes move the same data, but the length must be a whole number of blocks
+static bool validBlockTransfer(int block_size, long length)
+{
+	return block_size > 0 && block_size % 16 == 0 && block_size <= 16384 && length % block_size == 0;
+}
+
+long EmulatedDevice::WriteToBlockPipeIn(int ep_addr, int block_size, long length, unsigned char *data)
+{
+	if (!validBlockTransfer(block_size, length)) return okCFrontPanel::InvalidBlockSize;
+	return WriteToPipeIn(ep_addr, length, data);
+}
+
+long EmulatedDevice::ReadFromBlockPipeOut(int ep_addr, int block_size, long length, unsigned char *data)
+{
+	if (!validBlockTransfer(block_size, length)) return okCFrontPanel::InvalidBlockSize;
+	return ReadFromPipeOut(ep_addr, length, data);
+}
+
+std::string EmulatedDevice::GetSerialNumber()
+{
+	std::lock_guard<std::mutex> lock(device_mutex);
+	return serial;
+}
@@ -0,0 +1,222 @@
+#include "performance.h"
+#include <iomanip>
+
+namespace
+{
+	void writeHex(std::ostream &out, const unsigned char *bytes, std::size_t size)
+	{
+		out << '"' << std::hex << std::setfill('0');
+		for (std::size_t i = 0; i < size; i++)
+		{
+			out << std::setw(2) << static_cast<unsigned int>(bytes[i]);
+		}
+		out << std::dec << std::setfill(' ') << '"';
+	}
+}
+
+// ERROR REPORT
+constexpr std::size_t ErrorReport::MAX_SAMPLES;
+constexpr std::size_t ErrorReport::SAMPLE_BYTES;
+
+void ErrorReport::reset()
+{
+	iteration = 0;
+	mismatched_bytes = 0;
+	first_iteration = 0;
+	first_offset = 0;
+	ranges.clear();
+	samples.clear();
+	lane_flips.clear();
+	truncated = false;
+}
+
+bool ErrorReport::reserve(std::size_t bytes)
+{
+	std::size_t used = ranges.size() * sizeof(Range) + samples.size() * sizeof(Sample);
+	if (used + bytes <= max_bytes) return true;
+	truncated = true;
+	return false;
+}
+
+void ErrorReport::countFirst(unsigned int at_iteration, uint64_t offset)
+{
+	if (mismatched_bytes == 0 || at_iteration < first_iteration ||
+		(at_iteration == first_iteration && offset < first_offset))
+	{
+		first_iteration = at_iteration;
+		first_offset = offset;
+	}
+}
+
+// Only called once a bulk compare failed, so it may walk the buffer byte by byte
+void ErrorReport::compare(const unsigned char *received, const unsigned char *expected, std::size_t size,
+						  uint64_t offset, unsigned int register_size)
+{
+	if (lane_flips.size() < register_size * 8) lane_flips.resize(register_size * 8, 0);
+	bool in_range = false;
+	for (std::size_t i = 0; i < size; i++)
+	{
+		unsigned char flipped = received[i] ^ expected[i];
+		if (!flipped)
+		{
+			in_range = false;
+			continue;
+		}
+		uint64_t position = offset + i;
+		countFirst(iteration, position);
+		mismatched_bytes++;
+		const unsigned int lane = (position % register_size) * 8;
+		for (unsigned int bit = 0; flipped; bit++, flipped >>= 1)
+		{
+			if (flipped & 1) lane_flips[lane + bit]++;
+		}
+
+		if (in_range)
+		{
+			ranges.back().length++;
+			continue;
+		}
+		in_range = reserve(sizeof(Range));
+		if (!in_range) continue;
+		ranges.push_back({iteration, position, 1});
+		if (samples.size() < MAX_SAMPLES && reserve(sizeof(Sample)))
+		{
+			// Dump starts on a 16 byte boundary of the buffer when it fits
+			std::size_t start = std::min(i - i % SAMPLE_BYTES, size > SAMPLE_BYTES ? size - SAMPLE_BYTES : 0);
+			Sample sample;
+			sample.iteration = iteration;
+			sample.offset = offset + start;
+			sample.length = std::min(SAMPLE_BYTES, size - start);
+			std::copy(received + start, received + start + sample.length, sample.received);
+			std::copy(expected + start, expected + start + sample.length, sample.expected);
+			samples.push_back(sample);
+		}
+	}
+}
+
+void ErrorReport::merge(const ErrorReport &other)
+{
+	if (other.mismatched_bytes == 0) return;
+	countFirst(other.first_iteration, other.first_offset);
+	mismatched_bytes += other.mismatched_bytes;
+	if (lane_flips.size() < other.lane_flips.size()) lane_flips.resize(other.lane_flips.size(), 0);
+	for (std::size_t lane = 0; lane < other.lane_flips.size(); lane++)
+	{
+		lane_flips[lane] += other.lane_flips[lane];
+	}
+	for (const auto &range : other.ranges)
+	{
+		if (!reserve(sizeof(Range))) break;
+		ranges.push_back(range);
+	}
+	for (const auto &sample : other.samples)
+	{
+		if (samples.size() >= MAX_SAMPLES || !reserve(sizeof(Sample))) break;
+		samples.push_back(sample);
+	}
+	truncated = truncated || other.truncated;
+}
+
+// Shards may arrive in any order and split a range at their boundary
+void ErrorReport::writeJson(std::ostream &out)
+{
+	auto before = [](unsigned int a_iteration, uint64_t a_offset, unsigned int b_iteration, uint64_t b_offset)
+	{
+		return a_iteration < b_iteration || (a_iteration == b_iteration && a_offset < b_offset);
+	};
+	std::sort(ranges.begin(), ranges.end(), [&](const Range &a, const Range &b)
+	{
+		return before(a.iteration, a.offset, b.iteration, b.offset);
+	});
+	std::sort(samples.begin(), samples.end(), [&](const Sample &a, const Sample &b)
+	{
+		return before(a.iteration, a.offset, b.iteration, b.offset);
+	});
+	std::vector<Range> merged;
+	for (const auto &range : ranges)
+	{
+		if (!merged.empty() && merged.back().iteration == range.iteration &&
+			merged.back().offset + merged.back().length == range.offset)
+		{
+			merged.back().length += range.length;
+		}
+		else
+		{
+			merged.push_back(range);
+		}
+	}
+	ranges.swap(merged);
+
+	out << "\"mismatched_bytes\":" << mismatched_bytes;
+	if (mismatched_bytes > 0)
+	{
+		out << ",\"first_iteration\":" << first_iteration << ",\"first_offset\":" << first_offset;
+	}
+	out << ",\"truncated\":" << (truncated ? "true" : "false") << ",\"ranges\":[";
+	for (std::size_t i = 0; i < ranges.size(); i++)
+	{
+		out << (i ? "," : "") << '[' << ranges[i].iteration << ',' << ranges[i].offset << ','
+			<< ranges[i].length << ']';
+	}
+	out << "],\"lane_flips\":[";
+	for (std::size_t lane = 0; lane < lane_flips.size(); lane++)
+	{
+		out << (lane ? "," : "") << lane_flips[lane];
+	}
+	out << "],\"samples\":[";
+	for (std::size_t i = 0; i < samples.size(); i++)
+	{
+		out << (i ? "," : "") << "{\"iteration\":" << samples[i].iteration << ",\"offset\":"
+			<< samples[i].offset << ",\"received\":";
+		writeHex(out, samples[i].received, samples[i].length);
+		out << ",\"expected\":";
+		writeHex(out, samples[i].expected, samples[i].length);
+		out << '}';
+	}
+	out << ']';
+}
+
+// ERROR REPORT FILE
+ErrorReportFile::ErrorReportFile(Configurations &cfgs) :
+cfgs(cfgs), next_id{1}
+{
+	if (cfgs.error_report_path.empty()) return;
+	if (cfgs.resume)
+	{
+		// Ids continue after the reports of the interrupted run
+		std::ifstream existing_file(cfgs.error_report_path);
+		std::string line;
+		while (std::getline(existing_file, line)) next_id++;
+	}
+	std::ios::openmode mode = cfgs.resume ? std::ios::app : std::ios::trunc;
+	report_file.open(cfgs.error_report_path, std::ios::out | mode);
+	if (!report_file.good()) LOG(FATAL) << "Unable to open " << cfgs.error_report_path;
+	DLOG(INFO) << "ErrorReportFile class initialized";
+}
+
+// Returns the id the results row links to, 0 when nothing was written
+unsigned int ErrorReportFile::write(const std::string &serial, const TestPoint &point, unsigned int stat_iteration,
+									unsigned int errors, ErrorReport &report)
+{
+	if (cfgs.error_report_path.empty() || (errors == 0 && report.mismatched_bytes == 0)) return 0;
+
+	std::lock_guard<std::mutex> lock(file_mutex);
+	const unsigned int id = next_id++;
+	report_file << "{\"report\":" << id << ",\"device\":";
+	writeJsonString(report_file, serial);
+	report_file << ",\"mode\":";
+	writeJsonString(report_file, point.mode);
+	report_file << ",\"direction\":";
+	writeJsonString(report_file, point.direction);
+	report_file << ",\"memory\":";
+	writeJsonString(report_file, point.memory);
+	report_file << ",\"depth\":" << point.depth << ",\"pattern_size\":" << point.pattern_size
+				<< ",\"block_size\":" << point.block_size << ",\"pattern\":";
+	writeJsonString(report_file, point.pattern);
+	// Write direction errors come from the FPGA checker, which only counts them
+	report_file << ",\"stat_iteration\":" << stat_iteration << ",\"errors\":" << errors << ',';
+	report.writeJson(report_file);
+	report_file << '}' << std::endl;
+	LOG(WARNING) << "Error report " << id << " written to " << cfgs.error_report_path;
+	return id;
+}
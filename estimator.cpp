@@ -0,0 +1,379 @@
+#include "performance.h"
+#include <iomanip>
+
+namespace
+{
+	// Buffer timed per mode and pattern for the host generation and verification rates
+	constexpr unsigned int HOST_SAMPLE_BYTES {4 << 20};
+	constexpr unsigned int HOST_SAMPLE_RUNS {3};
+	// Control round trips outside the timed window: per statistical iteration (RESET twice, plus
+	// the clock readout for write, where the control queue has no latched readout to reuse) and
+	// per iteration (RESET_PATTERN and clock readout for read, clock readout for duplex, none for
+	// write which keeps one window). The pattern wire is only sent when it changes
+	constexpr double CONTROL_PER_STAT_ITERATION {2.0};
+	constexpr std::size_t REPORT_SLICES {10};
+
+	std::string formatDuration(double seconds)
+	{
+		std::ostringstream text;
+		if (seconds < 60.0)
+		{
+			text << std::fixed << std::setprecision(1) << seconds << " s";
+			return text.str();
+		}
+		long total = static_cast<long>(seconds + 0.5);
+		if (total >= 86400) text << total / 86400 << "d ";
+		text << std::setfill('0') << std::setw(2) << total / 3600 % 24 << ":" << std::setw(2) << total / 60 % 60
+			 << ":" << std::setw(2) << total % 60;
+		return text.str();
+	}
+
+	template <class F>
+	double bestRate(unsigned int bytes, F kernel)
+	{
+		double best_seconds = std::numeric_limits<double>::max();
+		for (unsigned int run = 0; run < HOST_SAMPLE_RUNS; run++)
+		{
+			auto start = PerfClock::now();
+			kernel();
+			best_seconds = std::min(best_seconds, std::chrono::duration<double>(PerfClock::now() - start).count());
+		}
+		return bytes / std::max(best_seconds, 1e-9);
+	}
+}
+
+SweepEstimator::Cost &SweepEstimator::Cost::operator+=(const Cost &other)
+{
+	transfer += other.transfer;
+	control += other.control;
+	generation += other.generation;
+	verification += other.verification;
+	bitfile += other.bitfile;
+	return *this;
+}
+
+SweepEstimator::SweepEstimator(Configurations &cfgs, const TestPlan &plan) :
+cfgs(cfgs), plan(plan), control_us{cfgs.emulator_settings.control_latency}, history_rows{0},
+fitted_points{0}, modelled_points{0}
+{
+	for (const auto &path : cfgs.estimate_results_v)
+	{
+		loadHistory(path);
+	}
+	fitHistory();
+	measureHostRates();
+	DLOG(INFO) << "SweepEstimator class initialized";
+}
+
+// Duplex times also depend on the block size, the other modes move the whole pattern
+std::string SweepEstimator::fitKey(const std::string &mode, const std::string &direction,
+								   const std::string &memory, const std::string &depth, const std::string &block)
+{
+	return mode + "|" + direction + "|" + memory + "|" + depth + "|" + block;
+}
+
+void SweepEstimator::loadHistory(const std::string &path)
+{
+	std::ifstream result_file(path);
+	if (!result_file.good())
+	{
+		LOG(WARNING) << "No earlier results in " << path << ". Using the emulator model there";
+		return;
+	}
+
+	const std::vector<std::string> needed{"Mode", "Direction", "FifoMemoryType", "FifoDepth", "PatternSize",
+										  "BlockSize", "PC time(per iteration) [us]"};
+	std::map<std::string, std::size_t> column;
+	std::size_t columns = 0;
+	unsigned int rows = 0;
+	std::string line;
+	while (std::getline(result_file, line))
+	{
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		std::vector<std::string> fields = splitRow(line, cfgs.result_sep);
+		if (std::find(fields.begin(), fields.end(), "Mode") != fields.end())
+		{
+			column.clear();
+			for (std::size_t i = 0; i < fields.size(); i++)
+			{
+				column[fields[i]] = i;
+			}
+			columns = fields.size();
+			continue;
+		}
+		if (fields.size() != columns) continue;
+		bool complete = true;
+		for (const auto &name : needed)
+		{
+			complete = complete && column.count(name) && !fields[column[name]].empty();
+		}
+		if (!complete) continue;
+
+		double size, time_us;
+		try
+		{
+			size = std::stod(fields[column["PatternSize"]]);
+			time_us = std::stod(fields[column["PC time(per iteration) [us]"]]);
+		}
+		catch (const std::exception &)
+		{
+			continue;
+		}
+		if (size <= 0.0 || time_us <= 0.0) continue;
+
+		const std::string &mode = fields[column["Mode"]];
+		const std::string block = (cfgs.mode_m.count(mode) && cfgs.mode_m.at(mode) == DUPLEX) ?
+								  fields[column["BlockSize"]] : "";
+		const std::string &direction = fields[column["Direction"]];
+		for (const std::string &key : {fitKey(mode, direction, fields[column["FifoMemoryType"]],
+											  fields[column["FifoDepth"]], block),
+									   fitKey(mode, direction, "", "", block)})
+		{
+			FitSums &sums = history[key];
+			sums.n += 1.0;
+			sums.x += size;
+			sums.y += time_us;
+			sums.xx += size * size;
+			sums.xy += size * time_us;
+		}
+		if (column.count("Trigger overhead [us]") && !fields[column["Trigger overhead [us]"]].empty())
+		{
+			double overhead = std::atof(fields[column["Trigger overhead [us]"]].c_str());
+			if (overhead > 0.0) trigger_overheads.push_back(overhead);
+		}
+		rows++;
+	}
+	history_rows += rows;
+	LOG(INFO) << "Dry run calibrated with " << rows << " rows of " << path;
+}
+
+// Least squares line per configuration. One size or a negative intercept falls back to a line
+// through the origin
+void SweepEstimator::fitHistory()
+{
+	for (const auto &entry : history)
+	{
+		const FitSums &s = entry.second;
+		TransferFit fit{0.0, 0.0, static_cast<unsigned int>(s.n)};
+		double det = s.n * s.xx - s.x * s.x;
+		if (det > 1e-9 * s.n * s.xx)
+		{
+			fit.per_byte_us = (s.n * s.xy - s.x * s.y) / det;
+			fit.intercept_us = (s.y - fit.per_byte_us * s.x) / s.n;
+		}
+		if (fit.per_byte_us <= 0.0 || fit.intercept_us < 0.0)
+		{
+			fit.per_byte_us = s.xy / s.xx;
+			fit.intercept_us = 0.0;
+		}
+		fits[entry.first] = fit;
+	}
+
+	if (!trigger_overheads.empty())
+	{
+		std::nth_element(trigger_overheads.begin(), trigger_overheads.begin() + trigger_overheads.size() / 2,
+						 trigger_overheads.end());
+		control_us = trigger_overheads[trigger_overheads.size() / 2];
+	}
+	LOG(INFO) << "Dry run control round trip: " << control_us << " us"
+			  << (trigger_overheads.empty() ? " (emulator model)" : " (median of earlier runs)");
+}
+
+void SweepEstimator::measureHostRates()
+{
+	std::set<std::pair<unsigned int, unsigned int>> used;
+	for (const auto &point : plan.points)
+	{
+		used.insert({cfgs.mode_m.at(point.mode), cfgs.pattern_m.at(point.pattern)});
+	}
+
+	std::unique_ptr<unsigned char[]> data(new unsigned char[HOST_SAMPLE_BYTES]);
+	std::unique_ptr<unsigned char[]> golden(new unsigned char[HOST_SAMPLE_BYTES]);
+	VerifierPool verifier{std::max(1u, cfgs.verify_threads / static_cast<unsigned int>(cfgs.device_serials.size()))};
+	for (const auto &key : used)
+	{
+		const unsigned int mode = key.first, pattern = key.second;
+		HostRates rates;
+		rates.fill = bestRate(HOST_SAMPLE_BYTES, [&]
+		{
+			DataGenerator(mode, pattern, HOST_SAMPLE_BYTES).fillArrayWithData(golden.get());
+		});
+		std::copy(golden.get(), golden.get() + HOST_SAMPLE_BYTES, data.get());
+		rates.verify_cached = bestRate(HOST_SAMPLE_BYTES, [&]
+		{
+			verifier.verify(mode, pattern, data.get(), HOST_SAMPLE_BYTES, golden.get());
+		});
+		rates.verify_generated = bestRate(HOST_SAMPLE_BYTES, [&]
+		{
+			verifier.verify(mode, pattern, data.get(), HOST_SAMPLE_BYTES, nullptr);
+		});
+		host_rates[key] = rates;
+		DLOG(INFO) << "Host rates for mode " << mode << ", pattern " << pattern << ": fill " << rates.fill
+				   << " B/s, verify " << rates.verify_cached << " / " << rates.verify_generated << " B/s";
+	}
+}
+
+// PC time of one iteration including its timed window, from the closest fit of earlier
+// results, else from the emulator model of the FIFO
+double SweepEstimator::iterationTransferUs(const TestPoint &point)
+{
+	const bool duplex = cfgs.mode_m.at(point.mode) == DUPLEX;
+	const std::string block = duplex ? std::to_string(point.block_size) : "";
+	for (const std::string &key : {fitKey(point.mode, point.direction, point.memory, std::to_string(point.depth), block),
+								   fitKey(point.mode, point.direction, "", "", block)})
+	{
+		auto it = fits.find(key);
+		if (it == fits.end()) continue;
+		fitted_points++;
+		return it->second.intercept_us + it->second.per_byte_us * point.pattern_size;
+	}
+
+	modelled_points++;
+	const FifoModel &model = cfgs.emulator_settings.fifo_models[point.memory];
+	double bandwidth = model.bandwidth * point.depth / (point.depth + model.half_rate_depth);
+	double bytes = point.pattern_size;
+	double calls;
+	if (duplex)
+	{
+		calls = 2.0 * point.pattern_size / point.block_size;
+		bytes *= 2.0;
+	}
+	else
+	{
+		unsigned int chunk = cfgs.transfer_chunk_size ? cfgs.transfer_chunk_size : point.pattern_size;
+		calls = (point.pattern_size + chunk - 1) / chunk;
+	}
+	return 2.0 * control_us + calls * cfgs.emulator_settings.pipe_latency + bytes / bandwidth;
+}
+
+// Seconds of one test point over all statistical iterations, following the timers in timer.cpp
+SweepEstimator::Cost SweepEstimator::estimate(const TestPoint &point)
+{
+	const unsigned int mode = cfgs.mode_m.at(point.mode);
+	const unsigned int direction = cfgs.direction_m.at(point.direction);
+	const HostRates &rates = host_rates[{mode, cfgs.pattern_m.at(point.pattern)}];
+	const double stat_iterations = cfgs.statistic_iter;
+	const double measured = cfgs.iterations;
+	const double all = cfgs.warmup_iterations + measured;
+	const double size = point.pattern_size;
+	const bool cached = size <= static_cast<double>(cfgs.pattern_cache_size) * (1 << 20);
+
+	const double link_s = iterationTransferUs(point) / 1e6;
+	const double fill_s = size / rates.fill;
+	const double verify_s = size / (cached ? rates.verify_cached : rates.verify_generated);
+
+	Cost cost{0.0, 0.0, 0.0, 0.0, 0.0};
+	cost.transfer = stat_iterations * all * link_s;
+	double control_per_iteration = 0.0;
+	// The golden pattern is generated once while it fits the cache, else for every use
+	double golden_generations = cached ? 1.0 : stat_iterations;
+	if (mode == DUPLEX)
+	{
+		control_per_iteration = 1.0;
+		cost.generation = golden_generations * fill_s;
+		cost.verification = stat_iterations * all * size / rates.verify_cached;
+	}
+	else if (direction == READ)
+	{
+		control_per_iteration = 2.0;
+		cost.generation = cached ? fill_s : 0.0;
+		// With read_buffers > 1 only verification slower than the link adds time
+		double per_iteration = cfgs.read_buffers > 1 ? std::max(0.0, verify_s - link_s) : verify_s;
+		cost.verification = stat_iterations * measured * per_iteration;
+	}
+	else if (cfgs.write_mode == "streaming")
+	{
+		cost.generation = stat_iterations * all * std::max(0.0, fill_s - link_s);
+	}
+	else
+	{
+		cost.generation = golden_generations * fill_s;
+	}
+	double control_per_stat_iteration = CONTROL_PER_STAT_ITERATION + (mode != DUPLEX && direction == WRITE ? 1.0 : 0.0);
+	cost.control = stat_iterations * (control_per_stat_iteration + all * control_per_iteration) * control_us / 1e6;
+	return cost;
+}
+
+void SweepEstimator::printReport()
+{
+	const std::vector<std::vector<TestPoint>> shards = plan.split(cfgs.device_serials.size());
+	CompletedResults completed(cfgs);
+
+	Cost total{0.0, 0.0, 0.0, 0.0, 0.0};
+	double wall_seconds = 0.0;
+	uint64_t bytes = 0;
+	std::size_t points = 0, bitfiles = 0, skipped = 0;
+	std::map<std::string, Cost> by_bitfile, by_size;
+	for (const auto &shard : shards)
+	{
+		double shard_seconds = 0.0;
+		std::string loaded_bitfile;
+		for (const auto &point : shard)
+		{
+			// Same skip rule as TransferController for resumed grid sweeps
+			if (completed.containsAll(point) || (cfgs.ci_target > 0.0 && completed.contains(point, 1)))
+			{
+				skipped++;
+				continue;
+			}
+			Cost cost = estimate(point);
+			if (point.bitfile != loaded_bitfile)
+			{
+				cost.bitfile = cfgs.bitfile_load_time;
+				loaded_bitfile = point.bitfile;
+				bitfiles++;
+			}
+			const std::string bitfile_slice = point.mode + " " + point.direction + " " + point.memory + " " +
+											  std::to_string(point.depth);
+			by_bitfile[bitfile_slice] += cost;
+			by_size[point.mode + " " + std::to_string(point.pattern_size) + " B"] += cost;
+			total += cost;
+			shard_seconds += cost.total();
+			uint64_t point_bytes = static_cast<uint64_t>(point.pattern_size) * cfgs.statistic_iter *
+								   (cfgs.warmup_iterations + cfgs.iterations);
+			bytes += cfgs.mode_m.at(point.mode) == DUPLEX ? 2 * point_bytes : point_bytes;
+			points++;
+		}
+		wall_seconds = std::max(wall_seconds, shard_seconds);
+	}
+
+	time_t end_time = time(0) + static_cast<time_t>(wall_seconds);
+	char end_text[80];
+	strftime(end_text, sizeof(end_text), "%Y-%m-%d %H:%M", localtime(&end_time));
+
+	const double sum = std::max(total.total(), 1e-9);
+	std::ostringstream report;
+	report << std::fixed << std::setprecision(1)
+		   << "Dry run: " << points << " test points (" << skipped << " already recorded), " << bitfiles
+		   << " bitfile loads, " << bytes / 1e9 << " GB over the link\n"
+		   << "Estimated sweep time " << formatDuration(wall_seconds) << " on " << shards.size()
+		   << " device(s), ends around " << end_text << "\n"
+		   << "  transfer " << 100 * total.transfer / sum << " %, control " << 100 * total.control / sum
+		   << " %, generation " << 100 * total.generation / sum << " %, verification "
+		   << 100 * total.verification / sum << " %, bitfile loads " << 100 * total.bitfile / sum << " %\n"
+		   << "  transfer times: " << fitted_points << " points fitted to " << history_rows
+		   << " earlier rows, " << modelled_points << " from the emulator model";
+	if (cfgs.sweep_mode == "adaptive" || cfgs.ci_target > 0.0)
+	{
+		report << "\n  upper bound: the " << (cfgs.sweep_mode == "adaptive" ? "adaptive sweep" : "ci_target")
+			   << " usually measures less";
+	}
+
+	for (const auto *slices : {&by_bitfile, &by_size})
+	{
+		std::vector<std::pair<std::string, Cost>> sorted(slices->begin(), slices->end());
+		std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Cost> &a,
+												   const std::pair<std::string, Cost> &b)
+		{
+			return a.second.total() > b.second.total();
+		});
+		report << "\nMost expensive " << (slices == &by_bitfile ? "bitfiles" : "pattern sizes") << ":";
+		for (std::size_t i = 0; i < std::min(REPORT_SLICES, sorted.size()); i++)
+		{
+			report << "\n  " << std::left << std::setw(36) << sorted[i].first << std::right
+				   << std::setw(14) << formatDuration(sorted[i].second.total()) << std::setw(8)
+				   << 100 * sorted[i].second.total() / sum << " %";
+		}
+	}
+	LOG(INFO) << report.str();
+}
@@ -0,0 +1,79 @@
+#include "performance.h"
+#include <algorithm>
+#include <cmath>
+
+constexpr unsigned int LatencyHistogram::SUB_BUCKETS;
+constexpr unsigned int LatencyHistogram::HALF_SUB_BUCKETS;
+constexpr unsigned int LatencyHistogram::MAGNITUDES;
+constexpr std::size_t LatencyHistogram::BUCKETS;
+
+// Values below SUB_BUCKETS get one bucket each. Every further power of two is split
+// into HALF_SUB_BUCKETS equal buckets, indexed by the top bits of the value.
+std::size_t LatencyHistogram::bucketIndex(uint64_t value)
+{
+	if (value < SUB_BUCKETS) return static_cast<std::size_t>(value);
+
+	unsigned int magnitude = 1;
+	while ((value >> magnitude) >= SUB_BUCKETS) magnitude++;
+	if (magnitude > MAGNITUDES) return BUCKETS - 1;
+
+	return SUB_BUCKETS + (magnitude - 1) * HALF_SUB_BUCKETS +
+		   static_cast<std::size_t>((value >> magnitude) - HALF_SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::bucketLow(std::size_t index)
+{
+	if (index < SUB_BUCKETS) return index;
+
+	unsigned int magnitude = static_cast<unsigned int>((index - SUB_BUCKETS) / HALF_SUB_BUCKETS) + 1;
+	uint64_t sub_bucket = (index - SUB_BUCKETS) % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+	return sub_bucket << magnitude;
+}
+
+uint64_t LatencyHistogram::bucketHigh(std::size_t index)
+{
+	if (index < SUB_BUCKETS) return index;
+
+	unsigned int magnitude = static_cast<unsigned int>((index - SUB_BUCKETS) / HALF_SUB_BUCKETS) + 1;
+	return bucketLow(index) + (static_cast<uint64_t>(1) << magnitude) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value_ns)
+{
+	counts[bucketIndex(value_ns)]++;
+	total++;
+	if (value_ns > max_value) max_value = value_ns;
+}
+
+void LatencyHistogram::reset()
+{
+	std::fill(counts.begin(), counts.end(), 0);
+	total = 0;
+	max_value = 0;
+}
+
+// Reports the highest value equivalent to the bucket holding the requested rank
+uint64_t LatencyHistogram::percentile(double percent) const
+{
+	if (total == 0) return 0;
+
+	uint64_t rank = static_cast<uint64_t>(std::ceil(percent / 100.0 * total));
+	if (rank == 0) rank = 1;
+	uint64_t seen = 0;
+	for (std::size_t i = 0; i < BUCKETS; i++)
+	{
+		seen += counts[i];
+		if (seen >= rank) return std::min(bucketHigh(i), max_value);
+	}
+	return max_value;
+}
+
+void LatencyHistogram::writeBuckets(std::ostream &out, const std::string &prefix,
+									const std::string &sep) const
+{
+	for (std::size_t i = 0; i < BUCKETS; i++)
+	{
+		if (counts[i] == 0) continue;
+		out << prefix << bucketLow(i) << sep << bucketHigh(i) << sep << counts[i] << '\n';
+	}
+}
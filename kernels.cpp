@@ -0,0 +1,441 @@
+#include "performance.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DATAKERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE2
+#endif
+
+// Streaming stores pay off only when the buffer would evict the cache anyway
+constexpr std::size_t NT_STORE_THRESHOLD {256 * 1024};
+constexpr std::size_t MAX_PERIOD         {512};
+
+namespace
+{
+	// One period of the counter_8bit and walking_1 patterns, padded so that a
+	// vector load may start anywhere inside the period
+	struct PeriodicTable
+	{
+		alignas(32) unsigned char bytes[MAX_PERIOD + 32];
+		std::size_t period;
+	};
+
+	void buildTable(unsigned int pattern, unsigned int register_size, PeriodicTable &table)
+	{
+		if (pattern == COUNTER_8BIT)
+		{
+			table.period = 256;
+			for (std::size_t i = 0; i < table.period; i++)
+			{
+				table.bytes[i] = static_cast<unsigned char>(i);
+			}
+		}
+		else
+		{
+			const unsigned int bits = register_size * 8;
+			table.period = register_size * bits;
+			for (unsigned int k = 0; k < bits; k++)
+			{
+				uint64_t word = static_cast<uint64_t>(1) << k;
+				for (unsigned int j = 0; j < register_size; j++)
+				{
+					table.bytes[k*register_size + j] = static_cast<unsigned char>(word >> j*8);
+				}
+			}
+		}
+		std::memcpy(table.bytes + table.period, table.bytes, 32);
+	}
+
+	inline unsigned int popcount32(uint32_t x)
+	{
+#if defined(__GNUC__)
+		return __builtin_popcount(x);
+#else
+		x = x - ((x >> 1) & 0x55555555);
+		x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+		return (((x + (x >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#endif
+	}
+
+	inline unsigned int countNonZeroBytes(uint64_t x)
+	{
+		x |= x >> 4;
+		x |= x >> 2;
+		x |= x >> 1;
+		x &= 0x0101010101010101ULL;
+		return static_cast<unsigned int>((x * 0x0101010101010101ULL) >> 56);
+	}
+
+	inline uint64_t loadWord(const unsigned char *data, unsigned int register_size)
+	{
+		uint64_t word = 0;
+		for (unsigned int j = 0; j < register_size; j++)
+		{
+			word |= static_cast<uint64_t>(data[j]) << j*8;
+		}
+		return word;
+	}
+
+	inline uint64_t counterWord(uint64_t word_index, unsigned int register_size)
+	{
+		return (register_size == 4) ? static_cast<uint32_t>(word_index) : word_index;
+	}
+
+	inline unsigned char counterByte(uint64_t position, unsigned int register_size)
+	{
+		uint64_t word = counterWord(position / register_size, register_size);
+		return static_cast<unsigned char>(word >> (position % register_size)*8);
+	}
+
+	// SCALAR
+	void fillPeriodicScalar(unsigned char *data, std::size_t size, const PeriodicTable &table,
+							uint64_t offset, std::size_t i)
+	{
+		std::size_t p = (offset + i) % table.period;
+		while (i < size)
+		{
+			std::size_t chunk = std::min(table.period - p, size - i);
+			std::memcpy(data + i, table.bytes + p, chunk);
+			i += chunk;
+			p = 0;
+		}
+	}
+
+	unsigned int verifyPeriodicScalar(const unsigned char *data, std::size_t size,
+									  const PeriodicTable &table, uint64_t offset, std::size_t i)
+	{
+		unsigned int errors = 0;
+		std::size_t p = (offset + i) % table.period;
+		for (; i + 8 <= size; i += 8)
+		{
+			uint64_t received, expected;
+			std::memcpy(&received, data + i, 8);
+			std::memcpy(&expected, table.bytes + p, 8);
+			errors += countNonZeroBytes(received ^ expected);
+			p += 8;
+			if (p >= table.period) p -= table.period;
+		}
+		for (; i < size; i++)
+		{
+			if (data[i] != table.bytes[p]) errors += 1;
+			if (++p == table.period) p = 0;
+		}
+		return errors;
+	}
+
+	// Advances i to the first byte starting a register word
+	std::size_t fillCounterHead(unsigned char *data, std::size_t size, unsigned int register_size,
+								uint64_t offset, std::size_t i)
+	{
+		for (; i < size && (offset + i) % register_size != 0; i++)
+		{
+			data[i] = counterByte(offset + i, register_size);
+		}
+		return i;
+	}
+
+	std::size_t verifyCounterHead(const unsigned char *data, std::size_t size, unsigned int register_size,
+								  uint64_t offset, std::size_t i, unsigned int &errors)
+	{
+		for (; i < size && (offset + i) % register_size != 0; i++)
+		{
+			if (data[i] != counterByte(offset + i, register_size)) errors += 1;
+		}
+		return i;
+	}
+
+	void fillCounterScalar(unsigned char *data, std::size_t size, unsigned int register_size,
+						   uint64_t offset, std::size_t i)
+	{
+		i = fillCounterHead(data, size, register_size, offset, i);
+		for (uint64_t k = (offset + i) / register_size; i + register_size <= size; i += register_size, k++)
+		{
+			uint64_t word = counterWord(k, register_size);
+			for (unsigned int j = 0; j < register_size; j++)
+			{
+				data[i + j] = static_cast<unsigned char>(word >> j*8);
+			}
+		}
+		for (; i < size; i++)
+		{
+			data[i] = counterByte(offset + i, register_size);
+		}
+	}
+
+	unsigned int verifyCounterScalar(const unsigned char *data, std::size_t size,
+									 unsigned int register_size, uint64_t offset, std::size_t i)
+	{
+		unsigned int errors = 0;
+		i = verifyCounterHead(data, size, register_size, offset, i, errors);
+		for (uint64_t k = (offset + i) / register_size; i + register_size <= size; i += register_size, k++)
+		{
+			errors += countNonZeroBytes(loadWord(data + i, register_size) ^ counterWord(k, register_size));
+		}
+		for (; i < size; i++)
+		{
+			if (data[i] != counterByte(offset + i, register_size)) errors += 1;
+		}
+		return errors;
+	}
+
+#ifdef DATAKERNELS_X86
+	// SSE2
+	TARGET_SSE2 inline __m128i counterLanesSse2(uint64_t first_word, unsigned int register_size)
+	{
+		if (register_size == 4)
+		{
+			int k = static_cast<int>(static_cast<uint32_t>(first_word));
+			return _mm_add_epi32(_mm_set1_epi32(k), _mm_setr_epi32(0, 1, 2, 3));
+		}
+		return _mm_set_epi64x(static_cast<long long>(first_word + 1), static_cast<long long>(first_word));
+	}
+
+	TARGET_SSE2 void fillPeriodicSse2(unsigned char *data, std::size_t size, const PeriodicTable &table,
+									  uint64_t offset)
+	{
+		const bool stream = size >= NT_STORE_THRESHOLD && reinterpret_cast<uintptr_t>(data) % 16 == 0;
+		std::size_t i = 0, p = offset % table.period;
+		for (; i + 16 <= size; i += 16)
+		{
+			__m128i expected = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.bytes + p));
+			if (stream) _mm_stream_si128(reinterpret_cast<__m128i *>(data + i), expected);
+			else _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), expected);
+			p += 16;
+			if (p >= table.period) p -= table.period;
+		}
+		if (stream) _mm_sfence();
+		fillPeriodicScalar(data, size, table, offset, i);
+	}
+
+	TARGET_SSE2 unsigned int verifyPeriodicSse2(const unsigned char *data, std::size_t size,
+												const PeriodicTable &table, uint64_t offset)
+	{
+		unsigned int errors = 0;
+		std::size_t i = 0, p = offset % table.period;
+		for (; i + 16 <= size; i += 16)
+		{
+			__m128i expected = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.bytes + p));
+			__m128i received = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+			uint32_t equal = _mm_movemask_epi8(_mm_cmpeq_epi8(expected, received));
+			errors += 16 - popcount32(equal);
+			p += 16;
+			if (p >= table.period) p -= table.period;
+		}
+		return errors + verifyPeriodicScalar(data, size, table, offset, i);
+	}
+
+	TARGET_SSE2 void fillCounterSse2(unsigned char *data, std::size_t size, unsigned int register_size,
+									 uint64_t offset)
+	{
+		std::size_t i = fillCounterHead(data, size, register_size, offset, 0);
+		const bool stream = size >= NT_STORE_THRESHOLD && reinterpret_cast<uintptr_t>(data + i) % 16 == 0;
+		__m128i counter = counterLanesSse2((offset + i) / register_size, register_size);
+		const __m128i step = (register_size == 4) ? _mm_set1_epi32(4) : _mm_set1_epi64x(2);
+		for (; i + 16 <= size; i += 16)
+		{
+			if (stream) _mm_stream_si128(reinterpret_cast<__m128i *>(data + i), counter);
+			else _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), counter);
+			counter = (register_size == 4) ? _mm_add_epi32(counter, step) : _mm_add_epi64(counter, step);
+		}
+		if (stream) _mm_sfence();
+		fillCounterScalar(data, size, register_size, offset, i);
+	}
+
+	TARGET_SSE2 unsigned int verifyCounterSse2(const unsigned char *data, std::size_t size,
+											   unsigned int register_size, uint64_t offset)
+	{
+		unsigned int errors = 0;
+		std::size_t i = verifyCounterHead(data, size, register_size, offset, 0, errors);
+		__m128i counter = counterLanesSse2((offset + i) / register_size, register_size);
+		const __m128i step = (register_size == 4) ? _mm_set1_epi32(4) : _mm_set1_epi64x(2);
+		for (; i + 16 <= size; i += 16)
+		{
+			__m128i received = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+			uint32_t equal = _mm_movemask_epi8(_mm_cmpeq_epi8(counter, received));
+			errors += 16 - popcount32(equal);
+			counter = (register_size == 4) ? _mm_add_epi32(counter, step) : _mm_add_epi64(counter, step);
+		}
+		return errors + verifyCounterScalar(data, size, register_size, offset, i);
+	}
+
+	// AVX2
+	TARGET_AVX2 inline __m256i counterLanesAvx2(uint64_t first_word, unsigned int register_size)
+	{
+		if (register_size == 4)
+		{
+			int k = static_cast<int>(static_cast<uint32_t>(first_word));
+			return _mm256_add_epi32(_mm256_set1_epi32(k), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+		}
+		return _mm256_add_epi64(_mm256_set1_epi64x(static_cast<long long>(first_word)),
+								_mm256_setr_epi64x(0, 1, 2, 3));
+	}
+
+	TARGET_AVX2 void fillPeriodicAvx2(unsigned char *data, std::size_t size, const PeriodicTable &table,
+									  uint64_t offset)
+	{
+		const bool stream = size >= NT_STORE_THRESHOLD && reinterpret_cast<uintptr_t>(data) % 32 == 0;
+		std::size_t i = 0, p = offset % table.period;
+		for (; i + 32 <= size; i += 32)
+		{
+			__m256i expected = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(table.bytes + p));
+			if (stream) _mm256_stream_si256(reinterpret_cast<__m256i *>(data + i), expected);
+			else _mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), expected);
+			p += 32;
+			if (p >= table.period) p -= table.period;
+		}
+		if (stream) _mm_sfence();
+		fillPeriodicScalar(data, size, table, offset, i);
+	}
+
+	TARGET_AVX2 unsigned int verifyPeriodicAvx2(const unsigned char *data, std::size_t size,
+												const PeriodicTable &table, uint64_t offset)
+	{
+		unsigned int errors = 0;
+		std::size_t i = 0, p = offset % table.period;
+		for (; i + 32 <= size; i += 32)
+		{
+			__m256i expected = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(table.bytes + p));
+			__m256i received = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+			uint32_t equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(expected, received));
+			errors += 32 - popcount32(equal);
+			p += 32;
+			if (p >= table.period) p -= table.period;
+		}
+		return errors + verifyPeriodicScalar(data, size, table, offset, i);
+	}
+
+	TARGET_AVX2 void fillCounterAvx2(unsigned char *data, std::size_t size, unsigned int register_size,
+									 uint64_t offset)
+	{
+		std::size_t i = fillCounterHead(data, size, register_size, offset, 0);
+		const bool stream = size >= NT_STORE_THRESHOLD && reinterpret_cast<uintptr_t>(data + i) % 32 == 0;
+		__m256i counter = counterLanesAvx2((offset + i) / register_size, register_size);
+		const __m256i step = (register_size == 4) ? _mm256_set1_epi32(8) : _mm256_set1_epi64x(4);
+		for (; i + 32 <= size; i += 32)
+		{
+			if (stream) _mm256_stream_si256(reinterpret_cast<__m256i *>(data + i), counter);
+			else _mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), counter);
+			counter = (register_size == 4) ? _mm256_add_epi32(counter, step) : _mm256_add_epi64(counter, step);
+		}
+		if (stream) _mm_sfence();
+		fillCounterScalar(data, size, register_size, offset, i);
+	}
+
+	TARGET_AVX2 unsigned int verifyCounterAvx2(const unsigned char *data, std::size_t size,
+											   unsigned int register_size, uint64_t offset)
+	{
+		unsigned int errors = 0;
+		std::size_t i = verifyCounterHead(data, size, register_size, offset, 0, errors);
+		__m256i counter = counterLanesAvx2((offset + i) / register_size, register_size);
+		const __m256i step = (register_size == 4) ? _mm256_set1_epi32(8) : _mm256_set1_epi64x(4);
+		for (; i + 32 <= size; i += 32)
+		{
+			__m256i received = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+			uint32_t equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(counter, received));
+			errors += 32 - popcount32(equal);
+			counter = (register_size == 4) ? _mm256_add_epi32(counter, step) : _mm256_add_epi64(counter, step);
+		}
+		return errors + verifyCounterScalar(data, size, register_size, offset, i);
+	}
+#endif
+
+	datakernels::InstructionSet detectInstructionSet()
+	{
+		datakernels::InstructionSet isa = datakernels::SCALAR;
+#if defined(DATAKERNELS_X86) && defined(__GNUC__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2")) isa = datakernels::SSE2;
+		if (__builtin_cpu_supports("avx2")) isa = datakernels::AVX2;
+#elif defined(DATAKERNELS_X86) && defined(_MSC_VER)
+		int cpu_info[4];
+		isa = datakernels::SSE2;
+		__cpuid(cpu_info, 1);
+		bool os_avx = (cpu_info[2] & (1 << 27)) && ((_xgetbv(0) & 6) == 6);
+		__cpuidex(cpu_info, 7, 0);
+		if (os_avx && (cpu_info[1] & (1 << 5))) isa = datakernels::AVX2;
+#endif
+		LOG(INFO) << "Data kernels use " << datakernels::instructionSetName(isa) << " instructions";
+		return isa;
+	}
+}
+
+datakernels::InstructionSet datakernels::bestInstructionSet()
+{
+	static const InstructionSet best = detectInstructionSet();
+	return best;
+}
+
+const char *datakernels::instructionSetName(InstructionSet isa)
+{
+	switch (isa)
+	{
+		case AVX2: return "AVX2";
+		case SSE2: return "SSE2";
+		default:   return "scalar";
+	}
+}
+
+bool datakernels::supportsPattern(unsigned int pattern)
+{
+	return pattern == COUNTER_8BIT || pattern == COUNTER_32BIT || pattern == WALKING_1;
+}
+
+void datakernels::fill(unsigned int pattern, unsigned int register_size, unsigned char *data,
+					   std::size_t size, uint64_t offset, InstructionSet isa)
+{
+	PeriodicTable table;
+	if (pattern != COUNTER_32BIT) buildTable(pattern, register_size, table);
+	switch (isa)
+	{
+#ifdef DATAKERNELS_X86
+		case AVX2:
+			if (pattern == COUNTER_32BIT) fillCounterAvx2(data, size, register_size, offset);
+			else fillPeriodicAvx2(data, size, table, offset);
+			return;
+
+		case SSE2:
+			if (pattern == COUNTER_32BIT) fillCounterSse2(data, size, register_size, offset);
+			else fillPeriodicSse2(data, size, table, offset);
+			return;
+#endif
+		default:
+			if (pattern == COUNTER_32BIT) fillCounterScalar(data, size, register_size, offset, 0);
+			else fillPeriodicScalar(data, size, table, offset, 0);
+			return;
+	}
+}
+
+unsigned int datakernels::verify(unsigned int pattern, unsigned int register_size,
+								 const unsigned char *data, std::size_t size, uint64_t offset,
+								 InstructionSet isa)
+{
+	PeriodicTable table;
+	if (pattern != COUNTER_32BIT) buildTable(pattern, register_size, table);
+	switch (isa)
+	{
+#ifdef DATAKERNELS_X86
+		case AVX2:
+			if (pattern == COUNTER_32BIT) return verifyCounterAvx2(data, size, register_size, offset);
+			return verifyPeriodicAvx2(data, size, table, offset);
+
+		case SSE2:
+			if (pattern == COUNTER_32BIT) return verifyCounterSse2(data, size, register_size, offset);
+			return verifyPeriodicSse2(data, size, table, offset);
+#endif
+		default:
+			if (pattern == COUNTER_32BIT) return verifyCounterScalar(data, size, register_size, offset, 0);
+			return verifyPeriodicScalar(data, size, table, offset, 0);
+	}
+}
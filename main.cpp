@@ -1,21 +1,63 @@
 #include "performance.h"
 
+// Runs one shard of the test plan on the board with the given serial
+static void runShard(const std::string &serial, Configurations &configs, SharedSweep &shared,
+					 const std::vector<TestPoint> &points)
+{
+	PhaseTracer::nameThread(serial.empty() ? "controller" : "controller " + serial);
+	IDevice *dev = okdev::createDevice(configs.device_type, configs.emulator_settings);
+	okdev::openDevice(dev, serial);
+
+	{
+		TransferController tc(dev, configs, shared);
+		tc.performTransferController(points);
+	}
+
+	delete dev;
+}
+
 int main(int argc, char *argv[]) {
 	google::InitGoogleLogging(argv[0]);
 	LOG(INFO) << "Program started";
-	okCFrontPanel *dev = new okCFrontPanel();
-	okdev::openDevice(dev);
-
-	const char *default_cfgpath;
-		if (argc > 1) default_cfgpath = argv[1];
-		else default_cfgpath = "../performance.cfg";
+	const char *default_cfgpath = "../performance.cfg";
+	bool dry_run = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--dry-run") dry_run = true;
+		else default_cfgpath = argv[i];
+	}
 	LOG(INFO) << "Path to config file: " << std::string(default_cfgpath);
 
-	Configurations configs(default_cfgpath);
-	configs.writeHeadersToResultFile();
+	Configurations configs(default_cfgpath, dry_run);
+	if (configs.phase_timing) PhaseTracer::enable(!configs.trace_path.empty());
 
-	TransferController tc(dev, configs);
-	tc.performTransferController();
+	TestPlan plan(configs);
+	plan.printSummary();
+	plan.preflight(configs.device_type != "emulator");
+	if (dry_run)
+	{
+		// Nothing below touches a device or the result files
+		SweepEstimator estimator(configs, plan);
+		estimator.printReport();
+		return 0;
+	}
 
-	delete dev;
+	{
+		SharedSweep shared(configs, plan);
+		std::vector<std::vector<TestPoint>> shards = plan.split(configs.device_serials.size());
+		std::vector<std::thread> controllers;
+		for (std::size_t i = 0; i < shards.size(); i++)
+		{
+			controllers.emplace_back(runShard, std::cref(configs.device_serials[i]), std::ref(configs),
+									 std::ref(shared), std::cref(shards[i]));
+		}
+		for (auto &controller : controllers)
+		{
+			controller.join();
+		}
+	}
+
+	// The sink and verifier threads have finished with the shared state
+	PhaseTracer::printSummary();
+	if (!configs.trace_path.empty()) PhaseTracer::writeTrace(configs.trace_path);
 }
@@ -1,6 +1,98 @@
 #include "performance.h"
 
-void okdev::checkIfOpen(okCFrontPanel *dev)
+// FRONTPANEL DEVICE
+bool FrontPanelDevice::IsOpen()
+{
+	return dev.IsOpen();
+}
+
+bool FrontPanelDevice::IsEmulated()
+{
+	return false;
+}
+
+okCFrontPanel::ErrorCode FrontPanelDevice::OpenBySerial(const std::string &serial)
+{
+	return dev.OpenBySerial(serial);
+}
+
+okCFrontPanel::ErrorCode FrontPanelDevice::ResetFPGA()
+{
+	return dev.ResetFPGA();
+}
+
+okCFrontPanel::ErrorCode FrontPanelDevice::ConfigureFPGA(const std::string &path_to_bitfile)
+{
+	return dev.ConfigureFPGA(path_to_bitfile);
+}
+
+std::string FrontPanelDevice::GetErrorString(int err_code)
+{
+	return dev.GetErrorString(err_code);
+}
+
+void FrontPanelDevice::SetWireInValue(int ep_addr, unsigned int value)
+{
+	dev.SetWireInValue(ep_addr, value);
+}
+
+void FrontPanelDevice::UpdateWireIns()
+{
+	dev.UpdateWireIns();
+}
+
+void FrontPanelDevice::UpdateWireOuts()
+{
+	dev.UpdateWireOuts();
+}
+
+unsigned int FrontPanelDevice::GetWireOutValue(int ep_addr)
+{
+	return dev.GetWireOutValue(ep_addr);
+}
+
+void FrontPanelDevice::ActivateTriggerIn(int ep_addr, int bit)
+{
+	dev.ActivateTriggerIn(ep_addr, bit);
+}
+
+long FrontPanelDevice::WriteToPipeIn(int ep_addr, long length, unsigned char *data)
+{
+	return dev.WriteToPipeIn(ep_addr, length, data);
+}
+
+long FrontPanelDevice::ReadFromPipeOut(int ep_addr, long length, unsigned char *data)
+{
+	return dev.ReadFromPipeOut(ep_addr, length, data);
+}
+
+long FrontPanelDevice::WriteToBlockPipeIn(int ep_addr, int block_size, long length, unsigned char *data)
+{
+	return dev.WriteToBlockPipeIn(ep_addr, block_size, length, data);
+}
+
+long FrontPanelDevice::ReadFromBlockPipeOut(int ep_addr, int block_size, long length, unsigned char *data)
+{
+	return dev.ReadFromBlockPipeOut(ep_addr, block_size, length, data);
+}
+
+std::string FrontPanelDevice::GetSerialNumber()
+{
+	return dev.GetSerialNumber();
+}
+
+// OKDEV
+IDevice *okdev::createDevice(const std::string &device_type, const EmulatorSettings &settings)
+{
+	if (device_type == "emulator")
+	{
+		LOG(WARNING) << "Using software FIFO emulator instead of FrontPanel device";
+		return new EmulatedDevice(settings);
+	}
+	return new FrontPanelDevice();
+}
+
+void okdev::checkIfOpen(IDevice *dev)
 {
 	DLOG(INFO) << "Checking if device is open...";
 	if (dev->IsOpen())
@@ -13,10 +105,10 @@ void okdev::checkIfOpen(okCFrontPanel *dev)
 	}
 }
 
-void okdev::openDevice(okCFrontPanel *dev)
+void okdev::openDevice(IDevice *dev, const std::string &serial)
 {
-	LOG(INFO) << "Trying to open device";
-	auto err_code = dev->OpenBySerial();
+	LOG(INFO) << "Trying to open device " << (serial.empty() ? "(first available)" : serial);
+	auto err_code = dev->OpenBySerial(serial);
 	if (err_code == okCFrontPanel::NoError)
 	{
 	LOG(INFO) << "Open status: " << dev->GetErrorString(err_code);
@@ -29,7 +121,7 @@ void okdev::openDevice(okCFrontPanel *dev)
 	dev->ResetFPGA();
 }
 
-void okdev::setupFPGA(okCFrontPanel *dev, const std::string &path_to_bitfile)
+void okdev::setupFPGA(IDevice *dev, const std::string &path_to_bitfile)
 {
 	DLOG(INFO) << "FPGA configure file: " << path_to_bitfile;
 	auto err_code = dev->ConfigureFPGA(path_to_bitfile);
@@ -43,3 +135,36 @@ void okdev::setupFPGA(okCFrontPanel *dev, const std::string &path_to_bitfile)
 				   << "] for file " << path_to_bitfile;
 	}
 }
+
+uint64_t okdev::readClockCounts(IDevice *dev)
+{
+	dev->UpdateWireOuts();
+	uint64_t counts = dev->GetWireOutValue(NUMBER_OF_COUNTS_A);
+	counts += static_cast<uint64_t>(dev->GetWireOutValue(NUMBER_OF_COUNTS_B)) << 32;
+	return counts;
+}
+
+// Times empty control round trips on a configured device. STOP_TIMER is a no-op while the
+// timer is stopped, and the closing RESET clears anything the calibration left behind
+ControlOverhead okdev::calibrateControlOverhead(IDevice *dev, unsigned int samples)
+{
+	SampleStatistics trigger_samples, wire_samples;
+	for (unsigned int i = 0; i < samples; i++)
+	{
+		auto start = PerfClock::now();
+		dev->ActivateTriggerIn(TRIGGER, STOP_TIMER);
+		auto stop = PerfClock::now();
+		trigger_samples.add(std::chrono::duration<double, std::micro>(stop - start).count());
+
+		start = PerfClock::now();
+		dev->UpdateWireOuts();
+		stop = PerfClock::now();
+		wire_samples.add(std::chrono::duration<double, std::micro>(stop - start).count());
+	}
+	dev->ActivateTriggerIn(TRIGGER, RESET);
+
+	ControlOverhead overhead{trigger_samples.median(), wire_samples.median()};
+	LOG(INFO) << "Control overhead from " << samples << " samples: trigger " << overhead.trigger
+			  << " us, wire " << overhead.wire << " us";
+	return overhead;
+}
@@ -1,14 +1,26 @@
 #ifndef FIFO_PERFORMANCE_H__
 #define FIFO_PERFORMANCE_H__
 
+#include <algorithm>
 #include <chrono>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <ctime>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <regex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <tuple>
 
 #include <glog/logging.h>
 #include <libconfig.h++>
@@ -16,11 +28,16 @@
 
 constexpr int MAX_PATTERN_SIZE {1073741824};
 constexpr double FIFO_CLOCK    {100.8};
+// The duplex design is only built with this depth (HDL/src/duplex/bidir/bidir_duplex_fifo.v)
+constexpr unsigned int DUPLEX_FIFO_DEPTH {2048};
+
+// Monotonic clock for every PC-side measurement, never slewed or stepped by NTP
+using PerfClock = std::chrono::steady_clock;
 
 enum Modes      {BIT32, NONSYM, DUPLEX};
 enum Directions {READ, WRITE};
 enum Memories   {BLOCKRAM, DISTRIBUTEDRAM, SHIFTREGISTER};
-enum Patterns   {COUNTER_8BIT, COUNTER_32BIT, WALKING_1, ASIC};
+enum Patterns   {COUNTER_8BIT, COUNTER_32BIT, WALKING_1, ASIC, PRBS7, PRBS15, PRBS23, PRBS31};
 enum Triggers   {RESET, START_TIMER, STOP_TIMER, RESET_PATTERN};
 enum Endpoints
 {
@@ -33,39 +50,340 @@ enum Endpoints
 	TRIGGER = 0x40
 };
 
+struct FifoModel
+{
+	double bandwidth;       // [MB/s] with an infinitely deep FIFO
+	double half_rate_depth; // FIFO depth at which half of the bandwidth is reached
+};
+
+struct EmulatorSettings
+{
+	bool realtime;          // sleep for the modelled transfer time
+	double control_latency; // [us] per wire/trigger round trip
+	double pipe_latency;    // [us] per pipe call
+	std::map<std::string, FifoModel> fifo_models;
+};
+
+// Median cost of one control round trip, measured on the configured device
+struct ControlOverhead
+{
+	double trigger; // [us] per ActivateTriggerIn
+	double wire;    // [us] per UpdateWireOuts
+};
+
+// Corrupted ASIC events per field, found by the PC side check
+struct AsicFieldErrors
+{
+	unsigned int id, channel, amplitude, timestamp;
+
+	AsicFieldErrors &operator+=(const AsicFieldErrors &other)
+	{
+		id += other.id;
+		channel += other.channel;
+		amplitude += other.amplitude;
+		timestamp += other.timestamp;
+		return *this;
+	}
+};
+
+// Wall time of the sweep phases per thread. A scope costs one relaxed load while disabled.
+// Names must be string literals, they are kept by pointer
+class PhaseTracer
+{
+	public:
+		class Scope
+		{
+			public:
+				Scope(const char *name) :
+				name{enabled.load(std::memory_order_relaxed) ? name : nullptr}
+				{
+					if (this->name) start = begin();
+				}
+				~Scope()
+				{
+					if (name) end(name, start);
+				}
+
+			private:
+				const char *name;
+				PerfClock::time_point start;
+		};
+
+		// keep_events stores every scope for writeTrace, else only the per-phase totals
+		static void enable(bool keep_events);
+		static void nameThread(const std::string &name);
+		// A span timed by the caller, where a scope would add its own cost to the measurement
+		static void record(const char *name, PerfClock::time_point start, PerfClock::time_point stop);
+		// Call once every traced thread has finished
+		static void printSummary();
+		static void writeTrace(const std::string &path);
+
+	private:
+		static std::atomic<bool> enabled;
+
+		static PerfClock::time_point begin();
+		static void end(const char *name, PerfClock::time_point start);
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) PhaseTracer::Scope TRACE_CONCAT(trace_scope_, __LINE__){name}
+
+class IDevice
+{
+	public:
+		virtual ~IDevice() {}
+
+		virtual bool IsOpen() = 0;
+		virtual bool IsEmulated() = 0;
+		virtual okCFrontPanel::ErrorCode OpenBySerial(const std::string &serial) = 0;
+		virtual okCFrontPanel::ErrorCode ResetFPGA() = 0;
+		virtual okCFrontPanel::ErrorCode ConfigureFPGA(const std::string &path_to_bitfile) = 0;
+		virtual std::string GetErrorString(int err_code) = 0;
+
+		virtual void SetWireInValue(int ep_addr, unsigned int value) = 0;
+		virtual void UpdateWireIns() = 0;
+		virtual void UpdateWireOuts() = 0;
+		virtual unsigned int GetWireOutValue(int ep_addr) = 0;
+		virtual void ActivateTriggerIn(int ep_addr, int bit) = 0;
+		virtual long WriteToPipeIn(int ep_addr, long length, unsigned char *data) = 0;
+		virtual long ReadFromPipeOut(int ep_addr, long length, unsigned char *data) = 0;
+		virtual long WriteToBlockPipeIn(int ep_addr, int block_size, long length, unsigned char *data) = 0;
+		virtual long ReadFromBlockPipeOut(int ep_addr, int block_size, long length, unsigned char *data) = 0;
+		virtual std::string GetSerialNumber() = 0;
+};
+
+class FrontPanelDevice : public IDevice
+{
+	public:
+		FrontPanelDevice()
+		{
+			DLOG(INFO) << "FrontPanel device initialized";
+		}
+
+		virtual bool IsOpen();
+		virtual bool IsEmulated();
+		virtual okCFrontPanel::ErrorCode OpenBySerial(const std::string &serial);
+		virtual okCFrontPanel::ErrorCode ResetFPGA();
+		virtual okCFrontPanel::ErrorCode ConfigureFPGA(const std::string &path_to_bitfile);
+		virtual std::string GetErrorString(int err_code);
+
+		virtual void SetWireInValue(int ep_addr, unsigned int value);
+		virtual void UpdateWireIns();
+		virtual void UpdateWireOuts();
+		virtual unsigned int GetWireOutValue(int ep_addr);
+		virtual void ActivateTriggerIn(int ep_addr, int bit);
+		virtual long WriteToPipeIn(int ep_addr, long length, unsigned char *data);
+		virtual long ReadFromPipeOut(int ep_addr, long length, unsigned char *data);
+		virtual long WriteToBlockPipeIn(int ep_addr, int block_size, long length, unsigned char *data);
+		virtual long ReadFromBlockPipeOut(int ep_addr, int block_size, long length, unsigned char *data);
+		virtual std::string GetSerialNumber();
+
+	private:
+		okCFrontPanel dev;
+};
+
+// PRBS bit stream (ITU-T O.150 polynomials, all-ones seed), 64 bits per step with the first bit in the MSB.
+// A register word holds the next register_size*8 bits and goes over the pipe little-endian like the other patterns
+class PrbsGenerator
+{
+	public:
+		PrbsGenerator(unsigned int pattern, uint64_t bit_offset = 0);
+
+		static bool isPrbs(unsigned int pattern);
+		static unsigned int step(uint32_t &state, unsigned int n, unsigned int m);
+		uint64_t next();
+		uint64_t nextWord(unsigned int register_size);
+
+	private:
+		unsigned int lag_n, lag_m, served;
+		uint64_t older, newer, pending;
+		bool half_pending;
+
+		uint64_t window(unsigned int lag) const;
+};
+
+// Word source mirroring HDL/src/*/dataGenerator.v
+class HdlPatternGenerator
+{
+	public:
+		HdlPatternGenerator() : register_size{4}, prbs{PRBS7}
+		{
+			reset(0);
+		}
+
+		unsigned int register_size;
+
+		void reset(unsigned int pattern);
+		uint64_t nextWord(unsigned int pattern);
+
+	private:
+		uint64_t dataout;
+		uint8_t id, channel;
+		uint16_t amplitude;
+		uint64_t timestamp;
+		PrbsGenerator prbs;
+};
+
+class EmulatedDevice : public IDevice
+{
+	public:
+		EmulatedDevice(const EmulatorSettings &settings) :
+		settings(settings), serial{"emulator"}, open{false}, configured{false}, virtual_time{0}
+		{
+			DLOG(INFO) << "Emulated device initialized";
+		}
+
+		virtual bool IsOpen();
+		virtual bool IsEmulated();
+		virtual okCFrontPanel::ErrorCode OpenBySerial(const std::string &serial);
+		virtual okCFrontPanel::ErrorCode ResetFPGA();
+		virtual okCFrontPanel::ErrorCode ConfigureFPGA(const std::string &path_to_bitfile);
+		virtual std::string GetErrorString(int err_code);
+
+		virtual void SetWireInValue(int ep_addr, unsigned int value);
+		virtual void UpdateWireIns();
+		virtual void UpdateWireOuts();
+		virtual unsigned int GetWireOutValue(int ep_addr);
+		virtual void ActivateTriggerIn(int ep_addr, int bit);
+		virtual long WriteToPipeIn(int ep_addr, long length, unsigned char *data);
+		virtual long ReadFromPipeOut(int ep_addr, long length, unsigned char *data);
+		virtual long WriteToBlockPipeIn(int ep_addr, int block_size, long length, unsigned char *data);
+		virtual long ReadFromBlockPipeOut(int ep_addr, int block_size, long length, unsigned char *data);
+		virtual std::string GetSerialNumber();
+
+	private:
+		const EmulatorSettings settings;
+		std::mutex device_mutex;
+
+		std::string serial;
+		bool open, configured;
+		unsigned int mode, direction, depth;
+		FifoModel fifo_model;
+
+		std::map<int, unsigned int> wire_ins_pending, wire_ins, wire_outs;
+		HdlPatternGenerator generator, checker;
+		std::deque<unsigned char> loopback;
+		unsigned int error_count;
+		bool timer_on;
+		double clk_counts, virtual_time;
+
+		void resetState();
+		void elapse(double duration_us);
+		unsigned int patternWire();
+		void fillFromGenerator(long length, unsigned char *data);
+		void checkAgainstPattern(long length, unsigned char *data);
+};
+
+// Every control call is its own USB round trip and FrontPanel has no call sending several at once,
+// so calls without effect on the FPGA are not sent: wire-ins go out with the next trigger or pipe
+// call and only when a value changed, wire-outs are latched again only after something could have
+// changed them, and RESET_PATTERN is dropped while generator and checker are still in reset state.
+// START_TIMER and STOP_TIMER always go through, so no measured window changes
+class ControlQueue : public IDevice
+{
+	public:
+		ControlQueue(IDevice *dev) :
+		dev{dev}, round_trips{0}, elided{0}
+		{
+			forgetDeviceState();
+			DLOG(INFO) << "ControlQueue class initialized";
+		}
+
+		~ControlQueue()
+		{
+			LOG(INFO) << "Control round trips: " << round_trips << " sent, " << elided << " not needed";
+		}
+
+		IDevice *dev;
+		// Control calls sent to the device and calls answered without a round trip
+		uint64_t round_trips, elided;
+
+		virtual bool IsOpen();
+		virtual bool IsEmulated();
+		virtual okCFrontPanel::ErrorCode OpenBySerial(const std::string &serial);
+		virtual okCFrontPanel::ErrorCode ResetFPGA();
+		virtual okCFrontPanel::ErrorCode ConfigureFPGA(const std::string &path_to_bitfile);
+		virtual std::string GetErrorString(int err_code);
+
+		virtual void SetWireInValue(int ep_addr, unsigned int value);
+		virtual void UpdateWireIns();
+		virtual void UpdateWireOuts();
+		virtual unsigned int GetWireOutValue(int ep_addr);
+		virtual void ActivateTriggerIn(int ep_addr, int bit);
+		virtual long WriteToPipeIn(int ep_addr, long length, unsigned char *data);
+		virtual long ReadFromPipeOut(int ep_addr, long length, unsigned char *data);
+		virtual long WriteToBlockPipeIn(int ep_addr, int block_size, long length, unsigned char *data);
+		virtual long ReadFromBlockPipeOut(int ep_addr, int block_size, long length, unsigned char *data);
+		virtual std::string GetSerialNumber();
+
+	private:
+		// Pipe calls of the streaming timers come from a second thread
+		std::mutex queue_mutex;
+		// Wire-in values as set, as requested by the last UpdateWireIns and as on the FPGA
+		std::map<int, unsigned int> wire_ins_set, wire_ins_requested, wire_ins_sent;
+		bool update_requested, wire_outs_latched, timer_stopped, pattern_reset;
+
+		void forgetDeviceState();
+		void flushWireIns();
+		void beforePipeCall();
+};
+
 namespace okdev
 {
-	void checkIfOpen(okCFrontPanel *dev);
-	void openDevice(okCFrontPanel *dev);
-	void setupFPGA(okCFrontPanel *dev, const std::string &path_to_bitfile);
+	IDevice *createDevice(const std::string &device_type, const EmulatorSettings &settings);
+	void checkIfOpen(IDevice *dev);
+	void openDevice(IDevice *dev, const std::string &serial);
+	void setupFPGA(IDevice *dev, const std::string &path_to_bitfile);
+	uint64_t readClockCounts(IDevice *dev);
+	ControlOverhead calibrateControlOverhead(IDevice *dev, unsigned int samples);
 }
 
+enum ResultTypes {TEXT_FIELD, INTEGER_FIELD, REAL_FIELD};
+
+struct ResultColumn
+{
+	std::string name;
+	ResultTypes type;
+};
+
+// Every column Results can produce, in the default order
+const std::vector<ResultColumn> &resultColumns();
+// Quoted and escaped JSON string, for the results, error reports and traces
+void writeJsonString(std::ostream &out, const std::string &value);
+// Fields of one results/tuning file row, split at the separator
+std::vector<std::string> splitRow(const std::string &line, const std::string &sep);
+
 class Configurations 
 {
 	public:
-		Configurations(const char *path_to_cfg) :
+		Configurations(const char *path_to_cfg, bool dry_run = false) :
+		dry_run{dry_run},
 		mode_m{{"32bit", BIT32}, {"nonsym", NONSYM}, {"duplex", DUPLEX}},
-		direction_m{{"read", READ}, {"write", WRITE}},
+		// "bidir" (duplex) is listed so lookups never insert while device threads share the map
+		direction_m{{"read", READ}, {"write", WRITE}, {"bidir", READ}},
 		pattern_m{{"counter_8bit", COUNTER_8BIT}, {"counter_32bit", COUNTER_32BIT},
-			{"walking_1", WALKING_1}, {"asic", ASIC}},
+			{"walking_1", WALKING_1}, {"asic", ASIC}, {"prbs7", PRBS7}, {"prbs15", PRBS15},
+			{"prbs23", PRBS23}, {"prbs31", PRBS31}},
 		path_regex{"(\\.|\\.\\.)[a-zA-Z0-9/\\ _-]*/$"},
-		headers_default{"Time", "Mode", "Direction",
-			"FifoMemoryType", "FifoDepth", "PatternSize", "BlockSize", "DataPattern", 
-			"Iterations", "StatisticalIter", "CountsInFPGA", "FPGA time(total) [us]", 
-			"FPGA time(per iteration) [us]", "PC time(total) [us]", 
-			"PC time(per iteration) [us]", "SpeedPC [B/s]", "SpeedFPGA [B/s]", "Errors"},
 		mode_default{"32bit", "nonsym", "duplex"},
 		direction_default{"read", "write"},
 		memory_default{"blockram", "distributedram", "shiftregister"},
 		depth_default{16, 64, 256, 1024, 2048},
 		block_size_default{16, 64, 256, 1024},
-		pattern_default{"counter_8bit", "counter_32bit", "walking_1", "asic"}
+		pattern_default{"counter_8bit", "counter_32bit", "walking_1", "asic", "prbs7", "prbs15", "prbs23", "prbs31"}
 		{
 			DLOG(INFO) << "Initialization Configuration class";
+			for (const auto &column : resultColumns())
+			{
+				headers_default.push_back(column.name);
+			}
 			libconfig::Config cfg;
 			openConfigFile(path_to_cfg, cfg);
 			configureOutput(cfg);
 			configureParams(cfg);
+			configureDevice(cfg);
+			configureEstimate(cfg);
 			LOG(INFO) << "Configuration class fully initialized";
 		}
 
@@ -74,11 +392,26 @@ class Configurations
 			DLOG(INFO) << "Destroying FIFO config class";
 		}
 		
+		// Only estimates the sweep, no device is opened
+		bool dry_run;
 		std::string bitfiles_path;
+		std::string device_type;
+		std::vector<std::string> device_serials;
+		EmulatorSettings emulator_settings;
 
 		// Parameters from 'output' scope
+		std::vector<std::string> headers_v;
 		std::string results_path;
 		std::string result_sep;
+		std::string result_format;
+		bool resume;
+		std::string latency_histogram_path;
+		std::string chunk_tuning_path;
+		std::string knee_report_path;
+		std::string error_report_path;
+		unsigned int error_report_memory;
+		bool phase_timing;
+		std::string trace_path;
 
 		// Parameters from 'params' scope
 		std::vector<std::string> mode_v;
@@ -90,18 +423,37 @@ class Configurations
 		std::vector<unsigned int> block_size_v;
 		std::vector<std::string> pattern_v;
 		unsigned int statistic_iter;
+		unsigned int min_statistic_iter;
+		double ci_target;
 		unsigned int iterations;
+		unsigned int warmup_iterations;
+		unsigned int calibration_samples;
+		unsigned int read_buffers;
+		unsigned int pattern_cache_size;
+		unsigned int verify_threads;
+		bool buffer_huge_pages;
+		bool buffer_lock;
+		std::string duplex_mode;
+		unsigned int duplex_in_flight;
+		std::string write_mode;
+		unsigned int write_buffers;
+		std::string sweep_mode;
+		double adaptive_tolerance;
+		unsigned int transfer_chunk_size;
+		unsigned int transfer_block_size;
+		bool autotune_chunks;
+
+		// Parameters from 'estimate' scope
+		std::vector<std::string> estimate_results_v;
+		double bitfile_load_time;
 
 		// Default hashes for params
 		std::map<std::string, unsigned int> mode_m;
 		std::map<std::string, unsigned int> direction_m;
 		std::map<std::string, unsigned int> pattern_m;
-		
-		void writeHeadersToResultFile();
 
 	private:
 		const std::regex path_regex;
-		std::vector<std::string> headers_v;
 		
 		// Default values for paramaters
 		std::vector<std::string> headers_default;
@@ -120,16 +472,275 @@ class Configurations
 
 		void integerParams(const libconfig::Setting &params);
 		void configureParams(libconfig::Config &cfg);
+		void configureFifoModel(const libconfig::Setting &emulator, const std::string &memory);
+		void configureEmulator(libconfig::Config &cfg);
+		void configureDevice(libconfig::Config &cfg);
+		void configureEstimate(libconfig::Config &cfg);
 		void configureOutputParameters(const libconfig::Setting &output);
 		void configureOutputBitfiles(libconfig::Config &cfg);
 		void configureOutput(libconfig::Config &cfg);
 		void openConfigFile(const char *cfg_path, libconfig::Config &cfg);
 };
 
+template <class T>
+class BlockingQueue
+{
+	public:
+		void push(const T &item)
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			items.push_back(item);
+			queue_cv.notify_one();
+		}
+
+		void push(T &&item)
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			items.push_back(std::move(item));
+			queue_cv.notify_one();
+		}
+
+		T pop()
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			queue_cv.wait(lock, [this]{ return !items.empty(); });
+			T item = std::move(items.front());
+			items.pop_front();
+			return item;
+		}
+
+		bool tryPop(T &item)
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			if (items.empty()) return false;
+			item = std::move(items.front());
+			items.pop_front();
+			return true;
+		}
+
+	private:
+		std::mutex queue_mutex;
+		std::condition_variable queue_cv;
+		std::deque<T> items;
+};
+
+// Expected data keyed on (mode, pattern, pattern_size) with LRU eviction
+class PatternCache
+{
+	public:
+		PatternCache(std::size_t capacity) :
+		capacity{capacity}, used{0}, hits{0}, misses{0}
+		{
+			DLOG(INFO) << "PatternCache class initialized with capacity " << capacity << " B";
+		}
+
+		~PatternCache()
+		{
+			LOG(INFO) << "Pattern cache hits: " << hits << ", misses: " << misses;
+		}
+
+		std::shared_ptr<const unsigned char> getPattern(unsigned int mode, unsigned int pattern,
+														unsigned int pattern_size);
+
+	private:
+		typedef std::tuple<unsigned int, unsigned int, unsigned int> Key;
+		struct Entry
+		{
+			Key key;
+			std::shared_ptr<const unsigned char> data;
+			std::size_t size;
+		};
+
+		const std::size_t capacity;
+		std::size_t used;
+		uint64_t hits, misses;
+		std::mutex cache_mutex;
+		std::list<Entry> lru;
+		std::map<Key, std::list<Entry>::iterator> index;
+
+		void evictUntilFits(std::size_t size);
+};
+
+// Where and how received data differed from the expected pattern. Detail is only collected
+// after a bulk compare failed. Ranges and samples stop growing at max_bytes
+class ErrorReport
+{
+	public:
+		ErrorReport(std::size_t max_bytes = 0) :
+		max_bytes{max_bytes}
+		{
+			reset();
+		}
+
+		static constexpr std::size_t MAX_SAMPLES {8};
+		static constexpr std::size_t SAMPLE_BYTES {16};
+
+		struct Range
+		{
+			unsigned int iteration;
+			uint64_t offset, length;
+		};
+		struct Sample
+		{
+			unsigned int iteration;
+			uint64_t offset;
+			std::size_t length;
+			unsigned char received[SAMPLE_BYTES], expected[SAMPLE_BYTES];
+		};
+
+		// Measured iteration the next compare belongs to
+		unsigned int iteration;
+		uint64_t mismatched_bytes;
+		unsigned int first_iteration;
+		uint64_t first_offset;
+		std::vector<Range> ranges;
+		std::vector<Sample> samples;
+		// Flipped bits per bit lane of the register word
+		std::vector<uint64_t> lane_flips;
+		bool truncated;
+
+		std::size_t maxBytes() const { return max_bytes; }
+		void reset();
+		void compare(const unsigned char *received, const unsigned char *expected, std::size_t size,
+					 uint64_t offset, unsigned int register_size);
+		void merge(const ErrorReport &other);
+		void writeJson(std::ostream &out);
+
+	private:
+		std::size_t max_bytes;
+
+		bool reserve(std::size_t bytes);
+		void countFirst(unsigned int at_iteration, uint64_t offset);
+};
+
+// Splits verification of one buffer into shards checked by worker threads
+class VerifierPool
+{
+	public:
+		VerifierPool(unsigned int threads);
+		~VerifierPool();
+
+		unsigned int verify(unsigned int mode, unsigned int pattern, unsigned char *data,
+							unsigned int pattern_size, const unsigned char *golden,
+							AsicFieldErrors *asic_errors = nullptr, ErrorReport *report = nullptr);
+
+	private:
+		std::vector<std::thread> workers;
+		BlockingQueue<std::function<void()>> tasks;
+
+		void runTasks();
+};
+
+// Page-aligned transfer buffers kept for the whole sweep. New buffers are pre-faulted (and
+// optionally backed by huge pages and locked) so no page fault lands in a timed window
+class BufferPool
+{
+	public:
+		BufferPool(bool huge_pages, bool lock_pages) :
+		huge_pages{huge_pages}, lock_pages{lock_pages}, allocated{0}, reused{0}
+		{
+			DLOG(INFO) << "BufferPool class initialized";
+		}
+		~BufferPool();
+
+		unsigned char *acquire(std::size_t size);
+		void release(unsigned char *data);
+		static std::size_t peakResidentBytes();
+
+	private:
+		struct Buffer
+		{
+			unsigned char *data;
+			std::size_t capacity;
+			bool in_use;
+		};
+
+		std::mutex pool_mutex;
+		std::vector<Buffer> buffers;
+		const bool huge_pages, lock_pages;
+		unsigned int allocated, reused;
+
+		unsigned char *allocate(std::size_t capacity);
+		void deallocate(const Buffer &buffer);
+};
+
+// Log-linear (HDR-style) histogram of latencies in ns: fixed memory, under 1.6% relative error
+class LatencyHistogram
+{
+	public:
+		LatencyHistogram() : counts(BUCKETS, 0), total{0}, max_value{0} {}
+
+		void record(uint64_t value_ns);
+		void reset();
+		uint64_t count() const { return total; }
+		uint64_t max() const { return max_value; }
+		uint64_t percentile(double percent) const;
+		void writeBuckets(std::ostream &out, const std::string &prefix, const std::string &sep) const;
+
+	private:
+		static constexpr unsigned int SUB_BUCKETS = 128;
+		static constexpr unsigned int HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+		static constexpr unsigned int MAGNITUDES = 40;
+		static constexpr std::size_t BUCKETS = SUB_BUCKETS + MAGNITUDES * HALF_SUB_BUCKETS;
+
+		std::vector<uint64_t> counts;
+		uint64_t total, max_value;
+
+		static std::size_t bucketIndex(uint64_t value);
+		static uint64_t bucketLow(std::size_t index);
+		static uint64_t bucketHigh(std::size_t index);
+};
+
+// Welford accumulator for per-iteration samples; keeps the samples for the median
+class SampleStatistics
+{
+	public:
+		SampleStatistics() : mean_value{0.0}, m2{0.0}, min_value{0.0}, max_value{0.0} {}
+
+		void add(double value);
+		void reset();
+		std::size_t count() const { return samples.size(); }
+		double mean() const { return mean_value; }
+		double min() const { return min_value; }
+		double max() const { return max_value; }
+		double stddev() const;
+		double median() const;
+		double confidenceInterval95() const;
+		unsigned int outliers() const;
+
+	private:
+		std::vector<double> samples;
+		double mean_value, m2, min_value, max_value;
+
+		static double quantile(std::vector<double> values, double fraction);
+		static double studentT95(std::size_t degrees_of_freedom);
+};
+
+struct ResultValue
+{
+	ResultTypes type;
+	std::string text;
+	int64_t integer;
+	double real;
+};
+
+// One results row keyed by column name. Columns without a value are written empty
+class ResultRecord
+{
+	public:
+		void setText(const std::string &column, const std::string &value);
+		void setInteger(const std::string &column, int64_t value);
+		void setReal(const std::string &column, double value);
+		const ResultValue *find(const std::string &column) const;
+
+	private:
+		std::map<std::string, ResultValue> values;
+};
+
 class Results
 {
 	public:
-		Results(okCFrontPanel *dev, Configurations &cfgs) :
+		Results(IDevice *dev, Configurations &cfgs) :
 		dev{dev}, cfgs{cfgs}, MEGA{1000000}
 		{
 			DLOG(INFO) << "Results class initialized";
@@ -140,76 +751,448 @@ class Results
 			DLOG(INFO) << "Destroying Results class";
 		};
 
-		unsigned int block_size, depth, errors, pattern_size, stat_iteration;
+		unsigned int block_size, depth, errors, pattern_size, stat_iteration, chunk_size;
 		std::string mode, direction, memory, pattern;
 		std::chrono::duration<double, std::micro> pc_duration_total;
+		LatencyHistogram latency;
+		SampleStatistics pc_samples, fpga_samples;
+		AsicFieldErrors asic_errors;
+		ControlOverhead overhead;
+		uint64_t window_triggers;
+		std::string bottleneck;
+		double generator_speed;
 
-		void saveResultsToFile();
+		ResultRecord createRecord();
+		// Speeds of the last created record
+		double fpga_speed, pc_speed;
 
 	private:
 		const int MEGA;
 		double fpga_time_total, fpga_time_periteravg;
 		double pc_time_total, pc_time_periteravg;
-		double fpga_speed, pc_speed;
+		double pc_time_corrected_periteravg, pc_speed_corrected;
 		uint64_t fpga_counts;
-		okCFrontPanel *dev;
+		IDevice *dev;
 		Configurations &cfgs;
 
 		const std::string logTime();
 		void countPCTime();
 		void countFPGATime();
+		void addSampleStatistics(ResultRecord &record, const std::string &clock,
+								 const SampleStatistics &samples);
+};
+
+class IResultFormat
+{
+	public:
+		virtual ~IResultFormat() {}
+
+		virtual std::ios::openmode openMode() const { return std::ios::out | std::ios::app; }
+		virtual void writeHeader(std::ostream &out, const std::vector<ResultColumn> &columns) = 0;
+		virtual void writeRecord(std::ostream &out, const std::vector<ResultColumn> &columns,
+								 const ResultRecord &record) = 0;
+};
+
+class CsvFormat : public IResultFormat
+{
+	public:
+		CsvFormat(const std::string &separator) : separator{separator} {}
+
+		virtual void writeHeader(std::ostream &out, const std::vector<ResultColumn> &columns);
+		virtual void writeRecord(std::ostream &out, const std::vector<ResultColumn> &columns,
+								 const ResultRecord &record);
+
+	private:
+		const std::string separator;
+};
+
+// One self-describing JSON object per row, so no header is written
+class JsonLinesFormat : public IResultFormat
+{
+	public:
+		virtual void writeHeader(std::ostream &, const std::vector<ResultColumn> &) {}
+		virtual void writeRecord(std::ostream &out, const std::vector<ResultColumn> &columns,
+								 const ResultRecord &record);
+};
+
+// Every run appends a header segment ("MGRRES01", schema) followed by fixed-size records,
+// each starting with 'R'. Text is NUL padded, numbers are little-endian int64/double.
+// Missing values are INT64_MIN and NaN. Read back with results_reader
+class BinaryFormat : public IResultFormat
+{
+	public:
+		static constexpr std::size_t TEXT_WIDTH = 24;
+
+		virtual std::ios::openmode openMode() const { return IResultFormat::openMode() | std::ios::binary; }
+		virtual void writeHeader(std::ostream &out, const std::vector<ResultColumn> &columns);
+		virtual void writeRecord(std::ostream &out, const std::vector<ResultColumn> &columns,
+								 const ResultRecord &record);
+};
+
+struct TestPoint
+{
+	std::string mode, direction, memory, pattern, bitfile;
+	unsigned int depth, pattern_size, block_size;
+};
+
+// Keeps the results and latency histogram files open for the whole run. Rows and histograms
+// are queued by the measuring thread and formatted and written by a background writer thread
+class ResultsSink
+{
+	public:
+		ResultsSink(Configurations &cfgs);
+		~ResultsSink();
+
+		void push(ResultRecord record);
+		void pushHistogram(const TestPoint &point, unsigned int stat_iteration, const LatencyHistogram &latency);
+
+	private:
+		enum ItemKinds {RECORD_ITEM, HISTOGRAM_ITEM, CLOSE_ITEM};
+		struct Item
+		{
+			ItemKinds kind;
+			ResultRecord record;
+			std::string histogram_prefix;
+			std::shared_ptr<const LatencyHistogram> histogram;
+		};
+
+		Configurations &cfgs;
+		std::vector<ResultColumn> columns;
+		std::unique_ptr<IResultFormat> format;
+		std::ofstream result_file, histogram_file;
+		BlockingQueue<Item> queue;
+		std::thread writer;
+
+		void selectColumns();
+		void openResultFile();
+		void openHistogramFile();
+		void writeItem(const Item &item);
+		void flushFiles();
+		void writeRecords();
 };
 
+// Expands the configuration into a flat list of test points grouped by bitfile
+class TestPlan
+{
+	public:
+		TestPlan(Configurations &cfgs) :
+		cfgs{cfgs}
+		{
+			DLOG(INFO) << "TestPlan class initialized";
+			compile();
+		}
+
+		std::vector<TestPoint> points;
+
+		void preflight(bool check_bitfiles);
+		void printSummary();
+		std::vector<std::vector<TestPoint>> split(std::size_t shards) const;
+
+	private:
+		Configurations &cfgs;
+
+		std::string bitfileFor(const TestPoint &point);
+		std::vector<std::string> directionsFor(unsigned int transfer_mode);
+		std::vector<std::string> memoriesFor(unsigned int transfer_mode);
+		std::vector<unsigned int> depthsFor(unsigned int transfer_mode, unsigned int transfer_direction);
+		void addPoints(TestPoint &point, unsigned int transfer_mode);
+		void groupByBitfile();
+		void compile();
+};
+
+// Test points already recorded in the results file of an interrupted sweep
+class CompletedResults
+{
+	public:
+		CompletedResults(Configurations &cfgs) :
+		cfgs{cfgs}
+		{
+			if (cfgs.resume) load();
+			DLOG(INFO) << "CompletedResults class initialized";
+		}
+
+		bool contains(const TestPoint &point, unsigned int stat_iteration);
+		bool containsAll(const TestPoint &point);
+
+	private:
+		Configurations &cfgs;
+		std::set<std::string> keys;
+
+		std::string key(const TestPoint &point, unsigned int stat_iteration);
+		void load();
+};
+
+// Predicts how long the test plan runs without opening a device. Transfer times are fitted to
+// earlier results files, else taken from the emulator model. Host generation and verification
+// rates are timed on this machine
+class SweepEstimator
+{
+	public:
+		SweepEstimator(Configurations &cfgs, const TestPlan &plan);
+
+		void printReport();
+
+	private:
+		// PC time per iteration = intercept + size * per_byte
+		struct TransferFit
+		{
+			double intercept_us, per_byte_us;
+			unsigned int rows;
+		};
+		struct FitSums
+		{
+			double n, x, y, xx, xy;
+		};
+		struct Cost
+		{
+			double transfer, control, generation, verification, bitfile;
+
+			double total() const { return transfer + control + generation + verification + bitfile; }
+			Cost &operator+=(const Cost &other);
+		};
+		struct HostRates
+		{
+			double fill, verify_cached, verify_generated; // [B/s]
+		};
+
+		Configurations &cfgs;
+		const TestPlan &plan;
+		std::map<std::string, FitSums> history;
+		std::map<std::string, TransferFit> fits;
+		std::map<std::pair<unsigned int, unsigned int>, HostRates> host_rates;
+		std::vector<double> trigger_overheads;
+		double control_us;
+		unsigned int history_rows, fitted_points, modelled_points;
+
+		static std::string fitKey(const std::string &mode, const std::string &direction,
+								  const std::string &memory, const std::string &depth, const std::string &block);
+		void loadHistory(const std::string &path);
+		void fitHistory();
+		void measureHostRates();
+		double iterationTransferUs(const TestPoint &point);
+		Cost estimate(const TestPoint &point);
+};
+
+// Fastest pipe call lengths found by the auto-tune pass, per device serial, mode and direction
+class ChunkTuning
+{
+	public:
+		ChunkTuning(const std::string &path, const std::string &sep, unsigned int block_size) :
+		path{path}, sep{sep}, block_size{block_size}
+		{
+			DLOG(INFO) << "ChunkTuning class initialized";
+			load();
+		}
+
+		unsigned int lookup(const std::string &serial, const std::string &mode, const std::string &direction);
+		void store(const std::string &serial, const std::string &mode, const std::string &direction,
+				   unsigned int chunk_size, double speed);
+		void save();
+
+	private:
+		const std::string path, sep;
+		const unsigned int block_size;
+		std::mutex tuning_mutex;
+		std::map<std::string, std::pair<unsigned int, double>> tuned;
+
+		std::string key(const std::string &serial, const std::string &mode, const std::string &direction);
+		void load();
+};
+
+// Knee size and plateau speed of every configuration searched by the adaptive sweep
+class KneeReport
+{
+	public:
+		KneeReport(Configurations &cfgs);
+
+		// knee_size 0 leaves knee and plateau empty, for a series that never levelled off
+		void add(const std::string &serial, const TestPoint &point, unsigned int knee_size,
+				 double plateau_speed, std::size_t measured);
+
+	private:
+		Configurations &cfgs;
+		std::mutex report_mutex;
+		std::ofstream report_file;
+};
+
+// Sweep progress over all devices with an ETA, weighted by the data each test point moves
+class SweepProgress
+{
+	public:
+		SweepProgress(const std::vector<TestPoint> &points);
+
+		// Fixed cost of a test point (control round trips, verification) in pattern bytes
+		static const uint64_t POINT_OVERHEAD_BYTES {65536};
+		static uint64_t weight(const TestPoint &point);
+		void advance(const TestPoint &point);
+		void skip(const TestPoint &point);
+
+	private:
+		std::mutex progress_mutex;
+		std::size_t total_points, done_points, skipped_points;
+		uint64_t total_weight, done_weight;
+		PerfClock::time_point start, last_report;
+
+		void report(PerfClock::time_point now);
+};
+
+// Error reports of all devices, one JSON line per results row with errors
+class ErrorReportFile
+{
+	public:
+		ErrorReportFile(Configurations &cfgs);
+
+		unsigned int write(const std::string &serial, const TestPoint &point, unsigned int stat_iteration,
+						   unsigned int errors, ErrorReport &report);
+
+	private:
+		Configurations &cfgs;
+		std::mutex file_mutex;
+		std::ofstream report_file;
+		unsigned int next_id;
+};
+
+// State shared by the controllers of all devices in one sweep
+class SharedSweep
+{
+	public:
+		SharedSweep(Configurations &cfgs, const TestPlan &plan) :
+		pattern_cache{static_cast<std::size_t>(cfgs.pattern_cache_size) << 20},
+		buffer_pool{cfgs.buffer_huge_pages, cfgs.buffer_lock}, completed{cfgs}, sink{cfgs},
+		tuning{cfgs.chunk_tuning_path, cfgs.result_sep, cfgs.transfer_block_size}, knee_report{cfgs}, error_reports{cfgs},
+		progress{plan.points}
+		{
+			DLOG(INFO) << "SharedSweep class initialized";
+		}
+
+		PatternCache pattern_cache;
+		BufferPool buffer_pool;
+		CompletedResults completed;
+		ResultsSink sink;
+		ChunkTuning tuning;
+		KneeReport knee_report;
+		ErrorReportFile error_reports;
+		SweepProgress progress;
+};
+
+class ITimer;
+
 class TransferController
 {
 	public:
-		TransferController(okCFrontPanel *dev, Configurations &cfgs) :
-		dev{dev}, cfgs{cfgs}
+		TransferController(IDevice *dev, Configurations &cfgs, SharedSweep &shared) :
+		control{dev}, dev{&control}, cfgs{cfgs}, serial{dev->GetSerialNumber()}, pattern_cache(shared.pattern_cache),
+		verifier{std::max(1u, cfgs.verify_threads / static_cast<unsigned int>(cfgs.device_serials.size()))},
+		buffer_pool(shared.buffer_pool), completed(shared.completed), results{&control, cfgs}, sink(shared.sink),
+		tuning(shared.tuning), knee_report(shared.knee_report), error_reports(shared.error_reports),
+		progress(shared.progress), error_report{static_cast<std::size_t>(cfgs.error_report_memory) << 10},
+		overhead{0.0, 0.0}, overhead_calibrated{false}
 		{
-			DLOG(INFO) << "TransferController class initialized";
+			DLOG(INFO) << "TransferController class initialized for device " << serial;
 		}
 		~TransferController()
 		{
 			DLOG(INFO) << "Destroying TransferController class";
 		}
 
-		void performTransferController();
+		void performTransferController(const std::vector<TestPoint> &points);
 	
 	private:
-		okCFrontPanel *dev;
+		ControlQueue control;
+		// The control queue, so the timers and results never bypass it
+		IDevice *dev;
 		Configurations &cfgs;
+		const std::string serial;
+		PatternCache &pattern_cache;
+		VerifierPool verifier;
+		BufferPool &buffer_pool;
+		CompletedResults &completed;
+		Results results;
+		ResultsSink &sink;
+		ChunkTuning &tuning;
+		KneeReport &knee_report;
+		ErrorReportFile &error_reports;
+		SweepProgress &progress;
+		std::string loaded_bitfile;
+		TestPoint current_point;
 
 		unsigned int transfer_direction;
 		unsigned int transfer_mode;
 
-		unsigned int block_size, depth, errors, pattern_size, stat_iteration;
+		unsigned int block_size, depth, errors, pattern_size, stat_iteration, chunk_size;
 		std::string mode, direction, memory, pattern;
 		std::chrono::duration<double, std::micro> pc_duration_total;
+		LatencyHistogram latency;
+		SampleStatistics pc_samples, fpga_samples;
+		AsicFieldErrors asic_errors;
+		ErrorReport error_report;
+		uint64_t window_triggers;
+		// Control round trips before the current statistical iteration started
+		uint64_t round_trips_start;
+		std::string bottleneck;
+		double generator_speed;
+		ControlOverhead overhead;
+		bool overhead_calibrated;
+		SampleStatistics pc_speeds, fpga_speeds;
+		std::vector<ResultRecord> point_records;
+		// Statistical iterations of the current point already in the resumed results file
+		unsigned int restored_iterations;
 
 		void saveResults();
+		void pushPointResults();
+		bool speedsConverged();
+		double pcSpeed();
+		void configureTimer(ITimer &timer);
+		void collectTimerResults(const ITimer &timer);
+		void loadBitfile(const std::string &bitfile);
+		void autotuneChunkSizes(const std::vector<TestPoint> &points);
 		void performReadTimer();
 		void performWriteTimer();
 		void performDuplexTimer();
 		void runTestBasedOnParameters();
-		void runOnSpecificPattern();
-		void runOnSpecificPatternSize();
-		void setupFPGA();
-		void runOnSpecificDepth(std::vector<unsigned int> &depth_v);
-		void specifyDepth(std::vector<unsigned int> &depth_v);
-		void specifyDirection(std::vector<std::string> &direction_v);
-		void runOnSpecificMemory(std::vector<std::string> &memory_v);
-		void runOnSpecificMode();
+		void runTestPoint(const TestPoint &point);
+		double measurePoint(const TestPoint &point);
+		void runAdaptiveSeries(const std::vector<TestPoint> &series);
 };
 
+// Word-wide fill/verify kernels for the counter and walking-1 patterns
+namespace datakernels
+{
+	enum InstructionSet {SCALAR, SSE2, AVX2};
+
+	InstructionSet bestInstructionSet();
+	const char *instructionSetName(InstructionSet isa);
+	bool supportsPattern(unsigned int pattern);
+	// offset is the position of data[0] in the pattern stream
+	void fill(unsigned int pattern, unsigned int register_size, unsigned char *data,
+			  std::size_t size, uint64_t offset = 0, InstructionSet isa = bestInstructionSet());
+	unsigned int verify(unsigned int pattern, unsigned int register_size, const unsigned char *data,
+						std::size_t size, uint64_t offset = 0, InstructionSet isa = bestInstructionSet());
+}
+
 class DataGenerator
 {
 	public:
-		DataGenerator(unsigned int mode, unsigned int pattern, unsigned int pattern_size) :
-		mode{mode}, pattern{pattern}, pattern_size{pattern_size}, errors{0}
+		// offset is the position of the first generated byte in the pattern stream
+		DataGenerator(unsigned int mode, unsigned int pattern, unsigned int pattern_size,
+					  uint64_t offset = 0) :
+		asic_errors{0, 0, 0, 0}, mode{mode}, pattern{pattern}, pattern_size{pattern_size}, errors{0},
+		offset{offset}
 		{
 			DLOG(INFO) << "DataGenerator class initialized";
 		}
 
+		struct AsicState
+		{
+			uint8_t id, channel;
+			uint16_t amplitude;
+			uint64_t timestamp;
+		};
+
+		static AsicState asicStateAt(uint64_t offset);
+
+		AsicFieldErrors asic_errors;
+
 		unsigned int checkArrayForErrors(unsigned char *data);
 		void fillArrayWithData(unsigned char *data);
 
@@ -219,12 +1202,12 @@ class DataGenerator
 		unsigned int mode, pattern, pattern_size;
 		unsigned int errors, register_size;
 		uint64_t max_register_size;
+		uint64_t offset;
 
 		void performActionOnGeneratedData(const unsigned char &data_char, unsigned int index);
 		void asic();
-		void walking1();
-		void counter32Bit();
-		void counter8Bit();
+		void checkAsicEvent(uint64_t difference);
+		void prbs();
 		void determineRegisterParameters();
 		void generateData();
 };
@@ -232,35 +1215,61 @@ class DataGenerator
 class ITimer
 {
 	public:
-		ITimer(okCFrontPanel *dev, unsigned int mode, unsigned int pattern, bool check_for_errors) :
-		dev{dev}, mode{mode}, pattern{pattern}, check_for_errors{check_for_errors}
+		ITimer(IDevice *dev, PatternCache &pattern_cache, VerifierPool &verifier, BufferPool &buffer_pool, unsigned int mode, unsigned int pattern, bool check_for_errors) :
+		dev{dev}, pattern_cache(pattern_cache), verifier(verifier), buffer_pool(buffer_pool),
+		mode{mode}, pattern{pattern},
+		check_for_errors{check_for_errors}, warmup_iterations{0}, chunk_size{0}, pipe_block_size{0}
 		{
 			DLOG(INFO) << "Timer interface initialized";
 		}
 		virtual ~ITimer() {}
 	
-		okCFrontPanel *dev;
+		IDevice *dev;
+		PatternCache &pattern_cache;
+		VerifierPool &verifier;
+		BufferPool &buffer_pool;
 
 		bool check_for_errors;
 		unsigned int errors;
+		AsicFieldErrors asic_errors;
+		// Detail of the mismatches behind errors, filled by the PC side checks only
+		ErrorReport error_report;
 		std::chrono::duration<double, std::micro> pc_duration_total;
-		std::chrono::time_point<std::chrono::system_clock> timer_start, timer_stop;
+		PerfClock::time_point timer_start, timer_stop;
+		// Trigger calls made inside the measured PC windows, corrected for in Results
+		uint64_t window_triggers;
+
+		// Iterations run before the measured ones and excluded from every result
+		unsigned int warmup_iterations;
+		// Bytes per pipe call (0 moves the whole pattern in one call) and, when non-zero,
+		// the block size of the block-throttled pipe calls used instead
+		unsigned int chunk_size, pipe_block_size;
+		SampleStatistics pc_samples, fpga_samples;
 
+		std::shared_ptr<const unsigned char> goldenPattern(unsigned int pattern_size);
 		void performActionOnData(unsigned char *data, unsigned int pattern_size);
 		void prepareForTransfer();
+		void startMeasuredIterations();
+		void recordFpgaIteration();
+		void startTimer();
+		void stopTimer();
+		void readPipe(unsigned char *data, unsigned int size);
+		void writePipe(unsigned char *data, unsigned int size);
 
 		virtual void performTimer(unsigned int pattern_size, unsigned int iterations) = 0;
 
-	private:
+	protected:
 		unsigned int mode, pattern;
 
+	private:
+		uint64_t fpga_counts_recorded;
 };
 
 class Read : public ITimer
 {
 	public:
-		Read(okCFrontPanel *dev, unsigned int mode, unsigned int pattern) :
-		ITimer(dev, mode, pattern, true)
+		Read(IDevice *dev, PatternCache &pattern_cache, VerifierPool &verifier, BufferPool &buffer_pool, unsigned int mode, unsigned int pattern) :
+		ITimer(dev, pattern_cache, verifier, buffer_pool, mode, pattern, true)
 		{
 			DLOG(INFO) << "Read class initialized";
 		}
@@ -268,11 +1277,30 @@ class Read : public ITimer
 		virtual void performTimer(unsigned int pattern_size, unsigned int iterations);
 };
 
+// Verifies iteration N on a worker thread while iteration N+1 is transferred
+class PipelinedRead : public ITimer
+{
+	public:
+		PipelinedRead(IDevice *dev, PatternCache &pattern_cache, VerifierPool &verifier, BufferPool &buffer_pool, unsigned int mode, unsigned int pattern, unsigned int buffers) :
+		ITimer(dev, pattern_cache, verifier, buffer_pool, mode, pattern, true), buffers{buffers}
+		{
+			DLOG(INFO) << "PipelinedRead class initialized with " << buffers << " buffers";
+		}
+
+		virtual void performTimer(unsigned int pattern_size, unsigned int iterations);
+
+	private:
+		unsigned int buffers;
+		BlockingQueue<unsigned char *> free_buffers, filled_buffers;
+
+		void verifyFilledBuffers(unsigned int pattern_size);
+};
+
 class Write : public ITimer
 {
 	public:
-		Write(okCFrontPanel *dev, unsigned int mode, unsigned int pattern) :
-		ITimer(dev, mode, pattern, false)
+		Write(IDevice *dev, PatternCache &pattern_cache, VerifierPool &verifier, BufferPool &buffer_pool, unsigned int mode, unsigned int pattern) :
+		ITimer(dev, pattern_cache, verifier, buffer_pool, mode, pattern, false)
 		{
 			DLOG(INFO) << "Write class initialized";
 		}
@@ -280,20 +1308,92 @@ class Write : public ITimer
 		virtual void performTimer(unsigned int pattern_size, unsigned int iterations);
 };
 
+// Sends a continuous stream: a producer thread generates each next chunk into a ring of
+// buffers while the current one is written. No RESET_PATTERN between iterations. Counters
+// and the ASIC id/channel/amplitude sequence continue across chunks, the ASIC timestamp
+// stays at 1 like in dataGenerator.v
+class StreamingWrite : public ITimer
+{
+	public:
+		StreamingWrite(IDevice *dev, PatternCache &pattern_cache, VerifierPool &verifier, BufferPool &buffer_pool, unsigned int mode, unsigned int pattern, unsigned int buffers) :
+		ITimer(dev, pattern_cache, verifier, buffer_pool, mode, pattern, false), buffers{buffers}
+		{
+			DLOG(INFO) << "StreamingWrite class initialized with " << buffers << " buffers";
+		}
+
+		std::string bottleneck;
+		double generator_speed;
+
+		virtual void performTimer(unsigned int pattern_size, unsigned int iterations);
+
+	private:
+		unsigned int buffers;
+		BlockingQueue<unsigned char *> free_buffers, filled_buffers;
+		std::chrono::duration<double, std::micro> generation_duration, link_duration;
+
+		void produceChunks(unsigned int pattern_size, unsigned int chunks);
+};
+
 class Duplex : public ITimer
 {
 	public:
-		Duplex(okCFrontPanel *dev, unsigned int mode, unsigned int pattern, unsigned int block_size) :
-		ITimer(dev, mode, pattern, false), block_size{block_size}
+		Duplex(IDevice *dev, PatternCache &pattern_cache, VerifierPool &verifier, BufferPool &buffer_pool, unsigned int mode, unsigned int pattern, unsigned int block_size) :
+		ITimer(dev, pattern_cache, verifier, buffer_pool, mode, pattern, false), block_size{block_size}
 		{
 			DLOG(INFO) << "Duplex class initialized";
 		}
 
+		// Round trip of every block, from the start of its write to the end of its read
+		LatencyHistogram latency;
+
 		virtual void performTimer(unsigned int pattern_size, unsigned int iterations);
 
+	protected:
+		unsigned int block_size;
+		void checkIfReceivedEqualsSend(unsigned char *send_data, unsigned char *received_data, uint64_t offset);
+};
+
+// Compares received duplex blocks with the sent ones on its own thread, while the next blocks
+// are transferred. The report is only touched by the checker until wait() returns
+class DuplexChecker
+{
+	public:
+		DuplexChecker(const unsigned char *sent, const unsigned char *received, unsigned int block_size, ErrorReport &report);
+		~DuplexChecker();
+
+		void check(unsigned int block);
+		// Waits for every block passed to check and returns how many of them differed
+		unsigned int wait();
+
 	private:
+		const unsigned char *sent, *received;
 		unsigned int block_size;
-		void checkIfReceivedEqualsSend(unsigned char *send_data, unsigned char *received_data);
+		ErrorReport &report;
+		unsigned int mismatches;
+		BlockingQueue<unsigned int> blocks, batches;
+		std::thread worker;
+
+		void checkBlocks();
+};
+
+// Writes run up to in_flight blocks ahead of the reads in one timing window, and the received
+// blocks are checked by a DuplexChecker. FrontPanel pipe calls are blocking and not thread-safe,
+// so the writes and reads still take turns on the link: this keeps the duplex FIFO filled
+// instead of measuring concurrent duplex bandwidth
+class StreamingDuplex : public Duplex
+{
+	public:
+		StreamingDuplex(IDevice *dev, PatternCache &pattern_cache, VerifierPool &verifier, BufferPool &buffer_pool, unsigned int mode, unsigned int pattern, unsigned int block_size, unsigned int in_flight) :
+		Duplex(dev, pattern_cache, verifier, buffer_pool, mode, pattern, block_size), in_flight{in_flight}
+		{
+			DLOG(INFO) << "StreamingDuplex class initialized with " << in_flight << " blocks in flight";
+		}
+
+		virtual void performTimer(unsigned int pattern_size, unsigned int iterations);
+
+	private:
+		unsigned int in_flight;
+		std::vector<PerfClock::time_point> write_started;
 };
 
 #endif // FIFO_PERFORMANCE_H__
\ No newline at end of file
@@ -0,0 +1,228 @@
+#include "performance.h"
+#include <algorithm>
+
+std::string TestPlan::bitfileFor(const TestPoint &point)
+{
+	return cfgs.bitfiles_path + point.mode + "/" + point.direction + "_" + point.mode + \
+		   "_fifo_" + point.memory + "_" + std::to_string(point.depth) + ".bit";
+}
+
+std::vector<std::string> TestPlan::directionsFor(unsigned int transfer_mode)
+{
+	if (transfer_mode == DUPLEX) return {"bidir"};
+	return cfgs.direction_v;
+}
+
+std::vector<std::string> TestPlan::memoriesFor(unsigned int transfer_mode)
+{
+	if (transfer_mode == NONSYM)
+	{
+		DLOG(WARNING) << "FYI: For nonsym mode, the only valid memory is blockram";
+		return {"blockram"};
+	}
+	return cfgs.memory_v;
+}
+
+std::vector<unsigned int> TestPlan::depthsFor(unsigned int transfer_mode, unsigned int transfer_direction)
+{
+	if (transfer_mode == DUPLEX)
+	{
+		return {DUPLEX_FIFO_DEPTH};
+	}
+
+	std::vector<unsigned int> depth_v = cfgs.depth_v;
+	if (transfer_mode == NONSYM && transfer_direction == WRITE)
+	{
+		for (auto &depth : depth_v)
+		{
+			if (depth == 16)
+			{
+				depth = 32;
+				DLOG(WARNING) << "Changed depth 16 to 32 for NONSYM WRITE mode";
+			}
+		}
+	}
+	return depth_v;
+}
+
+void TestPlan::addPoints(TestPoint &point, unsigned int transfer_mode)
+{
+	const std::vector<unsigned int> &size_v = (transfer_mode == DUPLEX) ? cfgs.pattern_size_duplex_v :
+																		  cfgs.pattern_size_v;
+	for (const auto &size : size_v)
+	{
+		point.pattern_size = size;
+		std::vector<unsigned int> block_v = {size};
+		if (transfer_mode == DUPLEX) block_v = cfgs.block_size_v;
+		for (const auto &block_size : block_v)
+		{
+			point.block_size = block_size;
+			for (const auto &pattern : cfgs.pattern_v)
+			{
+				if (transfer_mode != NONSYM && cfgs.pattern_m.at(pattern) == ASIC)
+				{
+					DLOG(INFO) << "Incompatible asic pattern with " << point.mode << " mode. Skipping.";
+					continue;
+				}
+				if (cfgs.device_type != "emulator" && PrbsGenerator::isPrbs(cfgs.pattern_m.at(pattern)))
+				{
+					DLOG(WARNING) << "No HDL generator for the " << pattern << " pattern yet. Skipping.";
+					continue;
+				}
+				point.pattern = pattern;
+				points.push_back(point);
+			}
+		}
+	}
+}
+
+void TestPlan::groupByBitfile()
+{
+	std::map<std::string, std::size_t> first_use;
+	for (const auto &point : points)
+	{
+		first_use.insert(std::make_pair(point.bitfile, first_use.size()));
+	}
+	std::stable_sort(points.begin(), points.end(), [&](const TestPoint &a, const TestPoint &b)
+	{
+		return first_use[a.bitfile] < first_use[b.bitfile];
+	});
+}
+
+void TestPlan::compile()
+{
+	for (const auto &mode : cfgs.mode_v)
+	{
+		unsigned int transfer_mode = cfgs.mode_m.at(mode);
+		TestPoint point;
+		point.mode = mode;
+		for (const auto &direction : directionsFor(transfer_mode))
+		{
+			point.direction = direction;
+			unsigned int transfer_direction = READ;
+			if (transfer_mode != DUPLEX) transfer_direction = cfgs.direction_m.at(direction);
+			for (const auto &memory : memoriesFor(transfer_mode))
+			{
+				point.memory = memory;
+				for (const auto &depth : depthsFor(transfer_mode, transfer_direction))
+				{
+					point.depth = depth;
+					point.bitfile = bitfileFor(point);
+					addPoints(point, transfer_mode);
+				}
+			}
+		}
+	}
+	groupByBitfile();
+}
+
+void TestPlan::preflight(bool check_bitfiles)
+{
+	unsigned int problems = 0;
+	std::string previous_bitfile;
+	for (const auto &point : points)
+	{
+		if (check_bitfiles && point.bitfile != previous_bitfile)
+		{
+			std::ifstream bitfile(point.bitfile);
+			if (!bitfile.good())
+			{
+				LOG(ERROR) << "Bitfile not accessible: " << point.bitfile;
+				problems++;
+			}
+		}
+		previous_bitfile = point.bitfile;
+
+		if (point.pattern_size == 0 || point.pattern_size > MAX_PATTERN_SIZE)
+		{
+			LOG(ERROR) << "Pattern size " << point.pattern_size << " must be in (0, "
+					   << MAX_PATTERN_SIZE << "]";
+			problems++;
+		}
+		if (cfgs.mode_m.at(point.mode) == DUPLEX &&
+			(point.block_size == 0 || point.block_size % 16 != 0 || point.block_size > 1024 ||
+			 point.pattern_size % point.block_size != 0))
+		{
+			LOG(ERROR) << "Invalid duplex block size " << point.block_size << " for pattern size "
+					   << point.pattern_size << ". Block size must be a multiple of 16, "
+					   << "<= 1024 and divide the pattern size";
+			problems++;
+		}
+		if (cfgs.mode_m.at(point.mode) == DUPLEX && cfgs.duplex_mode == "streaming" &&
+			cfgs.duplex_in_flight * point.block_size > point.depth * 4)
+		{
+			LOG(ERROR) << cfgs.duplex_in_flight << " blocks of " << point.block_size << " B in flight "
+					   << "overflow the " << point.depth << " word duplex FIFO";
+			problems++;
+		}
+		if (cfgs.mode_m.at(point.mode) != DUPLEX && cfgs.transfer_block_size > 0 &&
+			point.pattern_size % cfgs.transfer_block_size != 0)
+		{
+			LOG(ERROR) << "Pattern size " << point.pattern_size << " is not a whole number of "
+					   << cfgs.transfer_block_size << " B pipe blocks";
+			problems++;
+		}
+	}
+
+	if (cfgs.transfer_block_size > 0 && check_bitfiles)
+	{
+		LOG(WARNING) << "Block-throttled pipes need okBTPipeIn/okBTPipeOut endpoints. "
+					 << "The bitfiles built from HDL/src only have okPipeIn/okPipeOut";
+	}
+
+	if (problems > 0)
+	{
+		LOG(FATAL) << "Preflight found " << problems << " problems in the test plan";
+	}
+	LOG(INFO) << "Preflight passed for all " << points.size() << " test points";
+}
+
+void TestPlan::printSummary()
+{
+	std::size_t bitfiles = 0;
+	for (std::size_t i = 0; i < points.size(); i++)
+	{
+		if (i == 0 || points[i].bitfile != points[i-1].bitfile) bitfiles++;
+	}
+	LOG(INFO) << "Test plan: " << points.size() << " test points, " << bitfiles << " bitfiles, "
+			  << points.size() * cfgs.statistic_iter << " statistical iterations";
+}
+
+// Hands whole bitfile groups to the least loaded shard, largest groups first,
+// so every device loads each of its bitfiles once and the shards finish together
+std::vector<std::vector<TestPoint>> TestPlan::split(std::size_t shards) const
+{
+	std::vector<std::vector<TestPoint>> groups;
+	std::vector<uint64_t> group_weights;
+	for (std::size_t i = 0; i < points.size(); i++)
+	{
+		if (i == 0 || points[i].bitfile != points[i-1].bitfile)
+		{
+			groups.emplace_back();
+			group_weights.push_back(0);
+		}
+		groups.back().push_back(points[i]);
+		group_weights.back() += SweepProgress::weight(points[i]);
+	}
+
+	std::vector<std::size_t> order(groups.size());
+	for (std::size_t i = 0; i < order.size(); i++) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b)
+	{
+		return group_weights[a] > group_weights[b];
+	});
+
+	std::vector<std::vector<TestPoint>> shard_points(shards);
+	std::vector<uint64_t> shard_weights(shards, 0);
+	for (std::size_t group : order)
+	{
+		std::size_t lightest = std::min_element(shard_weights.begin(), shard_weights.end()) - shard_weights.begin();
+		shard_points[lightest].insert(shard_points[lightest].end(), groups[group].begin(), groups[group].end());
+		shard_weights[lightest] += group_weights[group];
+	}
+	for (std::size_t i = 0; i < shards; i++)
+	{
+		LOG(INFO) << "Shard " << i << ": " << shard_points[i].size() << " test points";
+	}
+	return shard_points;
+}
@@ -0,0 +1,143 @@
+#include "performance.h"
+
+namespace
+{
+	// ITU-T O.150 polynomials x^n + x^m + 1
+	struct PrbsPolynomial
+	{
+		unsigned int n, m;
+	};
+
+	PrbsPolynomial polynomialFor(unsigned int pattern)
+	{
+		switch (pattern)
+		{
+			case PRBS7:  return {7, 6};
+			case PRBS15: return {15, 14};
+			case PRBS23: return {23, 18};
+			case PRBS31: return {31, 28};
+		}
+		LOG(FATAL) << "Pattern " << pattern << " is not a PRBS pattern";
+		return {0, 0};
+	}
+
+	// The LFSR step is linear over GF(2): keep its 2^k-th powers as n column vectors
+	struct JumpTable
+	{
+		uint32_t columns[64][32];
+
+		JumpTable(PrbsPolynomial polynomial)
+		{
+			for (unsigned int j = 0; j < polynomial.n; j++)
+			{
+				uint32_t state = static_cast<uint32_t>(1) << j;
+				PrbsGenerator::step(state, polynomial.n, polynomial.m);
+				columns[0][j] = state;
+			}
+			for (unsigned int k = 1; k < 64; k++)
+			{
+				for (unsigned int j = 0; j < polynomial.n; j++)
+				{
+					columns[k][j] = apply(columns[k-1], columns[k-1][j]);
+				}
+			}
+		}
+
+		static uint32_t apply(const uint32_t *matrix, uint32_t state)
+		{
+			uint32_t result = 0;
+			for (unsigned int j = 0; state; j++, state >>= 1)
+			{
+				if (state & 1) result ^= matrix[j];
+			}
+			return result;
+		}
+	};
+
+	const JumpTable &jumpTableFor(unsigned int pattern)
+	{
+		static const JumpTable prbs7(polynomialFor(PRBS7)), prbs15(polynomialFor(PRBS15)),
+							   prbs23(polynomialFor(PRBS23)), prbs31(polynomialFor(PRBS31));
+		switch (pattern)
+		{
+			case PRBS7:  return prbs7;
+			case PRBS15: return prbs15;
+			case PRBS23: return prbs23;
+			default:     return prbs31;
+		}
+	}
+}
+
+bool PrbsGenerator::isPrbs(unsigned int pattern)
+{
+	return pattern == PRBS7 || pattern == PRBS15 || pattern == PRBS23 || pattern == PRBS31;
+}
+
+// Bit i of the state is s(k-1-i). Returns the new stream bit s(k) = s(k-n) ^ s(k-m)
+unsigned int PrbsGenerator::step(uint32_t &state, unsigned int n, unsigned int m)
+{
+	unsigned int bit = ((state >> (n - 1)) ^ (state >> (m - 1))) & 1;
+	state = ((state << 1) | bit) & ((n == 32) ? ~0u : (1u << n) - 1);
+	return bit;
+}
+
+// Jumps the all-ones seed ahead by bit_offset bits, then produces the first two words bit by bit
+// so that next() has the 128 bits of history it works from
+PrbsGenerator::PrbsGenerator(unsigned int pattern, uint64_t bit_offset) :
+served{0}, half_pending{false}
+{
+	PrbsPolynomial polynomial = polynomialFor(pattern);
+	// x^n + x^m + 1 squared j times is x^(n*2^j) + x^(m*2^j) + 1, so with m*2^j >= 64 a whole
+	// word depends only on the two words before it
+	unsigned int j = 0;
+	while ((polynomial.m << j) < 64) j++;
+	lag_n = polynomial.n << j;
+	lag_m = polynomial.m << j;
+
+	uint32_t state = (1u << polynomial.n) - 1;
+	const JumpTable &jump_table = jumpTableFor(pattern);
+	for (unsigned int k = 0; bit_offset; k++, bit_offset >>= 1)
+	{
+		if (bit_offset & 1) state = JumpTable::apply(jump_table.columns[k], state);
+	}
+
+	for (uint64_t *word : {&older, &newer})
+	{
+		*word = 0;
+		for (unsigned int i = 0; i < 64; i++)
+		{
+			*word = (*word << 1) | step(state, polynomial.n, polynomial.m);
+		}
+	}
+}
+
+// 64 bits starting lag bits before the next word, 64 <= lag <= 128
+uint64_t PrbsGenerator::window(unsigned int lag) const
+{
+	const unsigned int start = 128 - lag;
+	if (start == 0) return older;
+	if (start == 64) return newer;
+	return (older << start) | (newer >> (64 - start));
+}
+
+uint64_t PrbsGenerator::next()
+{
+	if (served < 2) return (served++ == 0) ? older : newer;
+	uint64_t word = window(lag_n) ^ window(lag_m);
+	older = newer;
+	newer = word;
+	return word;
+}
+
+uint64_t PrbsGenerator::nextWord(unsigned int register_size)
+{
+	if (register_size == 8) return next();
+	if (!half_pending)
+	{
+		pending = next();
+		half_pending = true;
+		return pending >> 32;
+	}
+	half_pending = false;
+	return pending & 0xFFFFFFFF;
+}
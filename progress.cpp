@@ -0,0 +1,58 @@
+#include "performance.h"
+#include <iomanip>
+
+namespace
+{
+	constexpr std::chrono::seconds PROGRESS_REPORT_INTERVAL {10};
+}
+
+SweepProgress::SweepProgress(const std::vector<TestPoint> &points) :
+total_points{points.size()}, done_points{0}, skipped_points{0}, total_weight{0}, done_weight{0},
+start{PerfClock::now()}, last_report{start}
+{
+	for (const auto &point : points)
+	{
+		total_weight += weight(point);
+	}
+	DLOG(INFO) << "SweepProgress class initialized";
+}
+
+uint64_t SweepProgress::weight(const TestPoint &point)
+{
+	return point.pattern_size + POINT_OVERHEAD_BYTES;
+}
+
+// Points restored by a resume take no time, so they leave the ETA out
+void SweepProgress::skip(const TestPoint &point)
+{
+	std::lock_guard<std::mutex> lock(progress_mutex);
+	total_points--;
+	skipped_points++;
+	total_weight -= weight(point);
+	if (done_points == total_points) report(PerfClock::now());
+}
+
+void SweepProgress::advance(const TestPoint &point)
+{
+	std::lock_guard<std::mutex> lock(progress_mutex);
+	done_points++;
+	done_weight += weight(point);
+
+	PerfClock::time_point now = PerfClock::now();
+	if (now - last_report < PROGRESS_REPORT_INTERVAL && done_points != total_points) return;
+	report(now);
+}
+
+void SweepProgress::report(PerfClock::time_point now)
+{
+	last_report = now;
+	double elapsed = std::chrono::duration<double>(now - start).count();
+	double fraction = total_weight ? static_cast<double>(done_weight) / total_weight : 1.0;
+	long eta = fraction > 0.0 ? static_cast<long>(elapsed * (1.0 - fraction) / fraction) : 0;
+	std::ostringstream eta_text;
+	eta_text << std::setfill('0') << std::setw(2) << eta / 3600 << ":" << std::setw(2) << eta / 60 % 60
+			 << ":" << std::setw(2) << eta % 60;
+	LOG(INFO) << "Progress: " << done_points << "/" << total_points << " test points ("
+			  << std::fixed << std::setprecision(1) << fraction * 100.0 << "%), ETA " << eta_text.str()
+			  << (skipped_points ? ", " + std::to_string(skipped_points) + " already recorded" : "");
+}
@@ -1,11 +1,17 @@
 #include "performance.h"
+#include <algorithm>
 
 const std::string Results::logTime()
 {
 	time_t now = time(0);
 	struct tm tstruct;
 	char buf[80];
-	tstruct = *localtime(&now);
+	{
+		// localtime returns a shared buffer
+		static std::mutex localtime_mutex;
+		std::lock_guard<std::mutex> lock(localtime_mutex);
+		tstruct = *localtime(&now);
+	}
 	strftime(buf, sizeof(buf), "%Y-%m-%d %X", &tstruct);
 
 	return buf;
@@ -18,14 +24,26 @@ void Results::countPCTime()
 	pc_speed = static_cast<double>(pattern_size) * MEGA / pc_time_periteravg;
 	LOG(INFO) << "Counted PC time for single duration: " << pc_time_periteravg << " msec";
 	LOG(INFO) << "Counted speed on PC side: " << pc_speed << " B/s";
+
+	double pc_time_corrected = pc_time_total - window_triggers * overhead.trigger;
+	if (pc_time_corrected <= 0.0)
+	{
+		LOG(WARNING) << "Trigger overhead exceeds the measured PC time. Corrected time not available";
+		pc_time_corrected = 0.0;
+	}
+	pc_time_corrected_periteravg = pc_time_corrected / cfgs.iterations;
+	pc_speed_corrected = pc_time_corrected > 0.0 ?
+		static_cast<double>(pattern_size) * MEGA / pc_time_corrected_periteravg : 0.0;
+	LOG(INFO) << "PC time without " << window_triggers << " trigger round trips: "
+			  << pc_time_corrected_periteravg << " us per iteration";
+	LOG(INFO) << "PC time per iteration: median " << pc_samples.median() << " us, stddev "
+			  << pc_samples.stddev() << " us, " << pc_samples.outliers() << " outliers";
 }
 
 void Results::countFPGATime()
 {
-	dev->UpdateWireOuts();
-	fpga_counts = dev->GetWireOutValue(NUMBER_OF_COUNTS_A);
-	fpga_counts += static_cast<uint64_t>(dev->GetWireOutValue(NUMBER_OF_COUNTS_B) << 32);
-	if (cfgs.direction_m[direction] == WRITE) errors = dev->GetWireOutValue(ERROR_COUNT);
+	fpga_counts = okdev::readClockCounts(dev);
+	if (cfgs.direction_m.at(direction) == WRITE) errors = dev->GetWireOutValue(ERROR_COUNT);
 
 	fpga_time_total = fpga_counts / FIFO_CLOCK;
 
@@ -38,39 +56,171 @@ void Results::countFPGATime()
 	LOG(WARNING) << "Errors detected during transfer: " << errors;
 }
 
-void Results::saveResultsToFile()
+ResultRecord Results::createRecord()
 {
+	TRACE_SCOPE("result record");
 	countPCTime();
 	countFPGATime();
-	std::fstream result_file;
-	std::string rs = cfgs.result_sep;
-	result_file.open(cfgs.results_path, std::ios::out | std::ios::app);
-	if (result_file.good())
+
+	ResultRecord record;
+	record.setText("Time", logTime());
+	record.setText("Mode", mode);
+	record.setText("Direction", direction);
+	record.setText("FifoMemoryType", memory);
+	record.setInteger("FifoDepth", depth);
+	record.setInteger("PatternSize", pattern_size);
+	record.setInteger("BlockSize", block_size);
+	record.setText("DataPattern", pattern);
+	record.setInteger("Iterations", cfgs.iterations);
+	record.setInteger("StatisticalIter", stat_iteration);
+	record.setInteger("CountsInFPGA", fpga_counts);
+	record.setReal("FPGA time(total) [us]", fpga_time_total);
+	record.setReal("FPGA time(per iteration) [us]", fpga_time_periteravg);
+	record.setReal("PC time(total) [us]", pc_time_total);
+	record.setReal("PC time(per iteration) [us]", pc_time_periteravg);
+	record.setReal("SpeedPC [B/s]", pc_speed);
+	record.setReal("SpeedFPGA [B/s]", fpga_speed);
+	record.setInteger("Errors", errors);
+	if (cfgs.pattern_m.at(pattern) == ASIC && cfgs.direction_m.at(direction) == READ)
+	{
+		record.setInteger("Errors(id)", asic_errors.id);
+		record.setInteger("Errors(channel)", asic_errors.channel);
+		record.setInteger("Errors(amplitude)", asic_errors.amplitude);
+		record.setInteger("Errors(timestamp)", asic_errors.timestamp);
+	}
+	if (latency.count() > 0)
+	{
+		record.setReal("Latency p50 [us]", latency.percentile(50.0) / 1000.0);
+		record.setReal("Latency p90 [us]", latency.percentile(90.0) / 1000.0);
+		record.setReal("Latency p99 [us]", latency.percentile(99.0) / 1000.0);
+		record.setReal("Latency p99.9 [us]", latency.percentile(99.9) / 1000.0);
+		record.setReal("Latency max [us]", latency.max() / 1000.0);
+	}
+	addSampleStatistics(record, "PC", pc_samples);
+	record.setInteger("PC outliers", pc_samples.outliers());
+	addSampleStatistics(record, "FPGA", fpga_samples);
+	record.setReal("Trigger overhead [us]", overhead.trigger);
+	record.setReal("PC time corrected(per iteration) [us]", pc_time_corrected_periteravg);
+	record.setReal("SpeedPC corrected [B/s]", pc_speed_corrected);
+	record.setInteger("PeakRSS [MB]", BufferPool::peakResidentBytes() >> 20);
+	record.setInteger("ChunkSize", chunk_size);
+	record.setText("DeviceSerial", dev->GetSerialNumber());
+	if (!bottleneck.empty())
+	{
+		record.setText("Bottleneck", bottleneck);
+		if (generator_speed > 0) record.setReal("SpeedGenerator [B/s]", generator_speed);
+	}
+
+	return record;
+}
+
+void Results::addSampleStatistics(ResultRecord &record, const std::string &clock,
+								  const SampleStatistics &samples)
+{
+	if (samples.count() == 0) return;
+	record.setReal(clock + " time(min) [us]", samples.min());
+	record.setReal(clock + " time(median) [us]", samples.median());
+	record.setReal(clock + " time(max) [us]", samples.max());
+	record.setReal(clock + " time(stddev) [us]", samples.stddev());
+	record.setReal(clock + " time(CI95) [us]", samples.confidenceInterval95());
+}
+
+// KNEE REPORT
+KneeReport::KneeReport(Configurations &cfgs) :
+cfgs(cfgs)
+{
+	if (cfgs.sweep_mode != "adaptive") return;
+	report_file.open(cfgs.knee_report_path, std::ios::trunc);
+	if (!report_file.good()) LOG(FATAL) << "Unable to open " << cfgs.knee_report_path;
+	const std::string &rs = cfgs.result_sep;
+	report_file << "DeviceSerial" << rs << "Mode" << rs << "Direction" << rs << "FifoMemoryType" << rs
+				<< "FifoDepth" << rs << "DataPattern" << rs << "KneeSize" << rs << "PlateauSpeed [B/s]"
+				<< rs << "MeasuredSizes" << std::endl;
+	DLOG(INFO) << "KneeReport class initialized";
+}
+
+void KneeReport::add(const std::string &serial, const TestPoint &point, unsigned int knee_size,
+					 double plateau_speed, std::size_t measured)
+{
+	const std::string &rs = cfgs.result_sep;
+	std::lock_guard<std::mutex> lock(report_mutex);
+	report_file << serial << rs << point.mode << rs << point.direction << rs << point.memory << rs
+				<< point.depth << rs << point.pattern << rs;
+	if (knee_size == 0)
+	{
+		report_file << rs << rs << measured << std::endl;
+		return;
+	}
+	report_file << knee_size << rs << plateau_speed << rs << measured << std::endl;
+	LOG(INFO) << "Knee of " << point.mode << " " << point.direction << " " << point.memory << " "
+			  << point.depth << " " << point.pattern << ": " << knee_size << " B, plateau "
+			  << plateau_speed << " B/s after " << measured << " sizes";
+}
+
+// COMPLETED RESULTS
+std::string CompletedResults::key(const TestPoint &point, unsigned int stat_iteration)
+{
+	return point.mode + "|" + point.direction + "|" + point.memory + "|" + std::to_string(point.depth) +
+		   "|" + std::to_string(point.pattern_size) + "|" + std::to_string(point.block_size) + "|" +
+		   point.pattern + "|" + std::to_string(stat_iteration);
+}
+
+bool CompletedResults::contains(const TestPoint &point, unsigned int stat_iteration)
+{
+	return keys.count(key(point, stat_iteration)) > 0;
+}
+
+bool CompletedResults::containsAll(const TestPoint &point)
+{
+	for (unsigned int i = 1; i <= cfgs.statistic_iter; i++)
+	{
+		if (!contains(point, i)) return false;
+	}
+	return true;
+}
+
+void CompletedResults::load()
+{
+	const std::vector<std::string> key_columns{"Mode", "Direction", "FifoMemoryType", "FifoDepth",
+											   "PatternSize", "BlockSize", "DataPattern", "StatisticalIter"};
+	std::ifstream result_file(cfgs.results_path);
+	if (!result_file.good())
 	{
-		result_file << logTime() << rs;
-		result_file << mode << rs;
-		result_file << direction << rs;
-		result_file << memory << rs;
-		result_file << depth << rs;
-		result_file << pattern_size << rs;
-		result_file << block_size << rs;
-		result_file << pattern << rs;
-		result_file << cfgs.iterations << rs;
-		result_file << stat_iteration << rs;
-		result_file << fpga_counts << rs;
-		result_file << fpga_time_total << rs;
-		result_file << fpga_time_periteravg << rs;
-		result_file << pc_time_total << rs;
-		result_file << pc_time_periteravg << rs;
-		result_file << pc_speed << rs;
-		result_file << fpga_speed  << rs;
-		result_file << errors;
-		result_file << std::endl;
-		result_file.close();
-		LOG(INFO) << "All results saved to " << cfgs.results_path;
+		LOG(WARNING) << "Nothing to resume: " << cfgs.results_path << " does not exist";
+		return;
 	}
-	else
+
+	std::map<std::string, std::size_t> column;
+	std::size_t columns = 0;
+	std::string line;
+	while (std::getline(result_file, line))
 	{
-		LOG(FATAL) << "Unable to open " << cfgs.results_path << " file during saving results";
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		std::vector<std::string> fields = splitRow(line, cfgs.result_sep);
+		if (std::find(fields.begin(), fields.end(), "Mode") != fields.end())
+		{
+			// Every run appends its own header line
+			column.clear();
+			for (std::size_t i = 0; i < fields.size(); i++)
+			{
+				column[fields[i]] = i;
+			}
+			columns = fields.size();
+			continue;
+		}
+		if (fields.size() != columns) continue;
+
+		std::string row_key;
+		for (const auto &name : key_columns)
+		{
+			if (column.find(name) == column.end())
+			{
+				LOG(FATAL) << "Cannot resume: column " << name << " missing in " << cfgs.results_path;
+			}
+			row_key += (row_key.empty() ? "" : "|") + fields[column[name]];
+		}
+		keys.insert(row_key);
 	}
+	LOG(INFO) << "Resuming sweep: " << keys.size() << " results already recorded in "
+			  << cfgs.results_path;
 }
\ No newline at end of file
@@ -0,0 +1,131 @@
+// Converts a results file written with result_format = "binary" back to separator-based CSV.
+// Layout (see BinaryFormat in sink.cpp): every run starts a segment with "MGRRES01",
+// uint32 column count, uint32 record size and per column uint8 type, uint8 name length
+// and the name. Records start with 'R' and hold 24-byte NUL padded text, int64 or double
+// fields in host byte order. Missing values are INT64_MIN and NaN.
+#include "performance.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace
+{
+	constexpr char MAGIC[] {"MGRRES01"};
+
+	struct Column
+	{
+		std::string name;
+		uint8_t type;
+	};
+
+	template <class T>
+	bool readBinary(std::istream &in, T &value)
+	{
+		char bytes[sizeof(T)];
+		if (!in.read(bytes, sizeof(T))) return false;
+		std::memcpy(&value, bytes, sizeof(T));
+		return true;
+	}
+
+	bool readHeader(std::istream &in, std::vector<Column> &columns)
+	{
+		char magic[sizeof(MAGIC) - 1];
+		uint32_t column_count, record_size;
+		if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(magic)) != 0) return false;
+		if (!readBinary(in, column_count) || !readBinary(in, record_size)) return false;
+
+		columns.clear();
+		for (uint32_t i = 0; i < column_count; i++)
+		{
+			uint8_t type, name_length;
+			if (!readBinary(in, type) || !readBinary(in, name_length)) return false;
+			std::string name(name_length, '\0');
+			if (!in.read(&name[0], name_length)) return false;
+			columns.push_back({name, type});
+		}
+		return true;
+	}
+
+	bool printRecord(std::istream &in, const std::vector<Column> &columns, const std::string &sep)
+	{
+		for (std::size_t i = 0; i < columns.size(); i++)
+		{
+			if (i > 0) std::cout << sep;
+			if (columns[i].type == TEXT_FIELD)
+			{
+				char text[BinaryFormat::TEXT_WIDTH];
+				if (!in.read(text, BinaryFormat::TEXT_WIDTH)) return false;
+				std::cout << std::string(text, strnlen(text, BinaryFormat::TEXT_WIDTH));
+			}
+			else if (columns[i].type == INTEGER_FIELD)
+			{
+				int64_t value;
+				if (!readBinary(in, value)) return false;
+				if (value != std::numeric_limits<int64_t>::min()) std::cout << value;
+			}
+			else
+			{
+				double value;
+				if (!readBinary(in, value)) return false;
+				if (!std::isnan(value)) std::cout << value;
+			}
+		}
+		std::cout << std::endl;
+		return true;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <results file> [separator]" << std::endl;
+		return 1;
+	}
+	std::ifstream in(argv[1], std::ios::binary);
+	if (!in.good())
+	{
+		std::cerr << "Unable to open " << argv[1] << std::endl;
+		return 1;
+	}
+	const std::string sep = argc > 2 ? argv[2] : ";";
+
+	std::vector<Column> columns;
+	int next;
+	while ((next = in.peek()) != std::char_traits<char>::eof())
+	{
+		if (next == MAGIC[0])
+		{
+			if (!readHeader(in, columns))
+			{
+				std::cerr << "Corrupted header in " << argv[1] << std::endl;
+				return 1;
+			}
+			for (std::size_t i = 0; i < columns.size(); i++)
+			{
+				std::cout << (i > 0 ? sep : "") << columns[i].name;
+			}
+			std::cout << std::endl;
+		}
+		else if (next == 'R' && !columns.empty())
+		{
+			in.get();
+			if (!printRecord(in, columns, sep))
+			{
+				std::cerr << "Truncated record in " << argv[1] << std::endl;
+				return 1;
+			}
+		}
+		else
+		{
+			std::cerr << "Unexpected data in " << argv[1] << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
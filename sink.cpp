@@ -0,0 +1,330 @@
+#include "performance.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+
+namespace
+{
+	constexpr char BINARY_MAGIC[] {"MGRRES01"};
+	constexpr char BINARY_RECORD_TAG {'R'};
+
+	template <class T>
+	void writeBinary(std::ostream &out, T value)
+	{
+		char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		out.write(bytes, sizeof(T));
+	}
+}
+
+const std::vector<ResultColumn> &resultColumns()
+{
+	static const std::vector<ResultColumn> columns{
+		{"Time", TEXT_FIELD}, {"Mode", TEXT_FIELD}, {"Direction", TEXT_FIELD},
+		{"FifoMemoryType", TEXT_FIELD}, {"FifoDepth", INTEGER_FIELD}, {"PatternSize", INTEGER_FIELD},
+		{"BlockSize", INTEGER_FIELD}, {"DataPattern", TEXT_FIELD}, {"Iterations", INTEGER_FIELD},
+		{"StatisticalIter", INTEGER_FIELD}, {"CountsInFPGA", INTEGER_FIELD},
+		{"FPGA time(total) [us]", REAL_FIELD}, {"FPGA time(per iteration) [us]", REAL_FIELD},
+		{"PC time(total) [us]", REAL_FIELD}, {"PC time(per iteration) [us]", REAL_FIELD},
+		{"SpeedPC [B/s]", REAL_FIELD}, {"SpeedFPGA [B/s]", REAL_FIELD}, {"Errors", INTEGER_FIELD},
+		{"Latency p50 [us]", REAL_FIELD}, {"Latency p90 [us]", REAL_FIELD},
+		{"Latency p99 [us]", REAL_FIELD}, {"Latency p99.9 [us]", REAL_FIELD},
+		{"Latency max [us]", REAL_FIELD}, {"PC time(min) [us]", REAL_FIELD},
+		{"PC time(median) [us]", REAL_FIELD}, {"PC time(max) [us]", REAL_FIELD},
+		{"PC time(stddev) [us]", REAL_FIELD}, {"PC time(CI95) [us]", REAL_FIELD},
+		{"PC outliers", INTEGER_FIELD}, {"FPGA time(min) [us]", REAL_FIELD},
+		{"FPGA time(median) [us]", REAL_FIELD}, {"FPGA time(max) [us]", REAL_FIELD},
+		{"FPGA time(stddev) [us]", REAL_FIELD}, {"FPGA time(CI95) [us]", REAL_FIELD},
+		{"Trigger overhead [us]", REAL_FIELD}, {"PC time corrected(per iteration) [us]", REAL_FIELD},
+		{"SpeedPC corrected [B/s]", REAL_FIELD}, {"PeakRSS [MB]", INTEGER_FIELD},
+		{"Bottleneck", TEXT_FIELD}, {"SpeedGenerator [B/s]", REAL_FIELD}, {"ChunkSize", INTEGER_FIELD},
+		{"Repetitions", INTEGER_FIELD}, {"DeviceSerial", TEXT_FIELD},
+		{"Errors(id)", INTEGER_FIELD}, {"Errors(channel)", INTEGER_FIELD}, {"Errors(amplitude)", INTEGER_FIELD},
+		{"Errors(timestamp)", INTEGER_FIELD}, {"ErrorReport", INTEGER_FIELD},
+		{"ControlRoundTrips", INTEGER_FIELD}};
+	return columns;
+}
+
+std::vector<std::string> splitRow(const std::string &line, const std::string &sep)
+{
+	std::vector<std::string> fields;
+	std::size_t start = 0, end;
+	while ((end = line.find(sep, start)) != std::string::npos)
+	{
+		fields.push_back(line.substr(start, end - start));
+		start = end + sep.size();
+	}
+	fields.push_back(line.substr(start));
+	return fields;
+}
+
+// RESULT RECORD
+void ResultRecord::setText(const std::string &column, const std::string &value)
+{
+	values[column] = {TEXT_FIELD, value, 0, 0.0};
+}
+
+void ResultRecord::setInteger(const std::string &column, int64_t value)
+{
+	values[column] = {INTEGER_FIELD, "", value, static_cast<double>(value)};
+}
+
+void ResultRecord::setReal(const std::string &column, double value)
+{
+	values[column] = {REAL_FIELD, "", static_cast<int64_t>(value), value};
+}
+
+const ResultValue *ResultRecord::find(const std::string &column) const
+{
+	auto it = values.find(column);
+	return it == values.end() ? nullptr : &it->second;
+}
+
+// CSV
+void CsvFormat::writeHeader(std::ostream &out, const std::vector<ResultColumn> &columns)
+{
+	for (std::size_t i = 0; i < columns.size(); i++)
+	{
+		if (i > 0) out << separator;
+		out << columns[i].name;
+	}
+	out << '\n';
+}
+
+void CsvFormat::writeRecord(std::ostream &out, const std::vector<ResultColumn> &columns,
+							const ResultRecord &record)
+{
+	for (std::size_t i = 0; i < columns.size(); i++)
+	{
+		if (i > 0) out << separator;
+		const ResultValue *value = record.find(columns[i].name);
+		if (value == nullptr) continue;
+		if (value->type == TEXT_FIELD) out << value->text;
+		else if (value->type == INTEGER_FIELD) out << value->integer;
+		else out << value->real;
+	}
+	out << '\n';
+}
+
+// JSON LINES
+void writeJsonString(std::ostream &out, const std::string &value)
+{
+	out << '"';
+	for (char c : value)
+	{
+		if (c == '"' || c == '\\') out << '\\' << c;
+		else if (static_cast<unsigned char>(c) < 0x20)
+			out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c)
+				<< std::dec << std::setfill(' ');
+		else out << c;
+	}
+	out << '"';
+}
+
+void JsonLinesFormat::writeRecord(std::ostream &out, const std::vector<ResultColumn> &columns,
+								  const ResultRecord &record)
+{
+	std::streamsize precision = out.precision(15);
+	out << '{';
+	for (std::size_t i = 0; i < columns.size(); i++)
+	{
+		if (i > 0) out << ',';
+		writeJsonString(out, columns[i].name);
+		out << ':';
+		const ResultValue *value = record.find(columns[i].name);
+		if (value == nullptr) out << "null";
+		else if (value->type == TEXT_FIELD) writeJsonString(out, value->text);
+		else if (value->type == INTEGER_FIELD) out << value->integer;
+		else if (!std::isfinite(value->real)) out << "null";
+		else out << value->real;
+	}
+	out << "}\n";
+	out.precision(precision);
+}
+
+// BINARY
+constexpr std::size_t BinaryFormat::TEXT_WIDTH;
+
+void BinaryFormat::writeHeader(std::ostream &out, const std::vector<ResultColumn> &columns)
+{
+	uint32_t record_size = 1;
+	for (const auto &column : columns)
+	{
+		record_size += column.type == TEXT_FIELD ? TEXT_WIDTH : 8;
+	}
+	out.write(BINARY_MAGIC, sizeof(BINARY_MAGIC) - 1);
+	writeBinary<uint32_t>(out, static_cast<uint32_t>(columns.size()));
+	writeBinary<uint32_t>(out, record_size);
+	for (const auto &column : columns)
+	{
+		std::size_t name_length = std::min<std::size_t>(column.name.size(), 255);
+		writeBinary<uint8_t>(out, static_cast<uint8_t>(column.type));
+		writeBinary<uint8_t>(out, static_cast<uint8_t>(name_length));
+		out.write(column.name.data(), name_length);
+	}
+}
+
+void BinaryFormat::writeRecord(std::ostream &out, const std::vector<ResultColumn> &columns,
+							   const ResultRecord &record)
+{
+	out.put(BINARY_RECORD_TAG);
+	for (const auto &column : columns)
+	{
+		const ResultValue *value = record.find(column.name);
+		if (column.type == TEXT_FIELD)
+		{
+			char text[TEXT_WIDTH] = {};
+			if (value != nullptr) value->text.copy(text, TEXT_WIDTH);
+			out.write(text, TEXT_WIDTH);
+		}
+		else if (column.type == INTEGER_FIELD)
+		{
+			writeBinary<int64_t>(out, value ? value->integer : std::numeric_limits<int64_t>::min());
+		}
+		else
+		{
+			writeBinary<double>(out, value ? value->real : std::numeric_limits<double>::quiet_NaN());
+		}
+	}
+}
+
+// RESULTS SINK
+ResultsSink::ResultsSink(Configurations &cfgs) :
+cfgs(cfgs)
+{
+	selectColumns();
+	if (cfgs.result_format == "jsonl") format.reset(new JsonLinesFormat());
+	else if (cfgs.result_format == "binary") format.reset(new BinaryFormat());
+	else format.reset(new CsvFormat(cfgs.result_sep));
+	openResultFile();
+	openHistogramFile();
+	writer = std::thread(&ResultsSink::writeRecords, this);
+	DLOG(INFO) << "ResultsSink class initialized";
+}
+
+ResultsSink::~ResultsSink()
+{
+	queue.push(Item{CLOSE_ITEM, ResultRecord(), "", nullptr});
+	writer.join();
+	result_file.close();
+	histogram_file.close();
+	LOG(INFO) << "All results saved to " << cfgs.results_path;
+}
+
+void ResultsSink::selectColumns()
+{
+	for (const auto &header : cfgs.headers_v)
+	{
+		for (const auto &column : resultColumns())
+		{
+			if (column.name == header) columns.push_back(column);
+		}
+	}
+}
+
+void ResultsSink::openResultFile()
+{
+	std::ifstream existing_file(cfgs.results_path);
+	bool resuming = cfgs.resume && existing_file.peek() != std::ifstream::traits_type::eof();
+	existing_file.close();
+
+	result_file.open(cfgs.results_path, format->openMode());
+	if (!result_file.good())
+	{
+		LOG(FATAL) << "Unable to open " << cfgs.results_path;
+	}
+	if (resuming)
+	{
+		LOG(INFO) << "Resuming into " << cfgs.results_path << ". Headers not written again";
+		return;
+	}
+	format->writeHeader(result_file, columns);
+	result_file.flush();
+	LOG(INFO) << "Headers have been written to: " << cfgs.results_path;
+}
+
+// Histograms of earlier runs are kept, the headers only go into an empty file
+void ResultsSink::openHistogramFile()
+{
+	if (cfgs.latency_histogram_path.empty()) return;
+	std::ifstream existing_file(cfgs.latency_histogram_path);
+	bool write_headers = existing_file.peek() == std::ifstream::traits_type::eof();
+	existing_file.close();
+
+	histogram_file.open(cfgs.latency_histogram_path, std::ios::out | std::ios::app);
+	if (!histogram_file.good())
+	{
+		LOG(FATAL) << "Unable to open " << cfgs.latency_histogram_path;
+	}
+	if (!write_headers) return;
+	const std::string &rs = cfgs.result_sep;
+	histogram_file << "Mode" << rs << "FifoMemoryType" << rs << "FifoDepth" << rs << "PatternSize"
+				   << rs << "BlockSize" << rs << "DataPattern" << rs << "StatisticalIter" << rs
+				   << "LatencyLow [ns]" << rs << "LatencyHigh [ns]" << rs << "Count" << std::endl;
+}
+
+void ResultsSink::push(ResultRecord record)
+{
+	queue.push(Item{RECORD_ITEM, std::move(record), "", nullptr});
+}
+
+void ResultsSink::pushHistogram(const TestPoint &point, unsigned int stat_iteration, const LatencyHistogram &latency)
+{
+	if (!histogram_file.is_open() || latency.count() == 0) return;
+	const std::string &rs = cfgs.result_sep;
+	std::ostringstream prefix;
+	prefix << point.mode << rs << point.memory << rs << point.depth << rs << point.pattern_size << rs
+		   << point.block_size << rs << point.pattern << rs << stat_iteration << rs;
+	queue.push(Item{HISTOGRAM_ITEM, ResultRecord(), prefix.str(), std::make_shared<LatencyHistogram>(latency)});
+}
+
+void ResultsSink::writeItem(const Item &item)
+{
+	TRACE_SCOPE("result writing");
+	if (item.kind == RECORD_ITEM)
+	{
+		format->writeRecord(result_file, columns, item.record);
+		return;
+	}
+	item.histogram->writeBuckets(histogram_file, item.histogram_prefix, cfgs.result_sep);
+	DLOG(INFO) << "Latency histogram (" << item.histogram->count() << " blocks) saved to "
+			   << cfgs.latency_histogram_path;
+}
+
+void ResultsSink::flushFiles()
+{
+	TRACE_SCOPE("result writing");
+	result_file.flush();
+	if (!result_file.good())
+	{
+		LOG(FATAL) << "Unable to write results to " << cfgs.results_path;
+	}
+	if (!histogram_file.is_open()) return;
+	histogram_file.flush();
+	if (!histogram_file.good())
+	{
+		LOG(FATAL) << "Unable to write latency histograms to " << cfgs.latency_histogram_path;
+	}
+}
+
+// Drains the queue and flushes once it runs empty, so a crash loses at most the pending rows
+void ResultsSink::writeRecords()
+{
+	PhaseTracer::nameThread("results sink");
+	Item item;
+	bool unflushed = false;
+	for (;;)
+	{
+		if (!queue.tryPop(item))
+		{
+			if (unflushed) flushFiles();
+			unflushed = false;
+			item = queue.pop();
+		}
+		if (item.kind == CLOSE_ITEM) break;
+		writeItem(item);
+		unflushed = true;
+	}
+	if (unflushed) flushFiles();
+}
@@ -0,0 +1,82 @@
+#include "performance.h"
+#include <algorithm>
+#include <cmath>
+
+void SampleStatistics::add(double value)
+{
+	samples.push_back(value);
+	double delta = value - mean_value;
+	mean_value += delta / samples.size();
+	m2 += delta * (value - mean_value);
+	if (samples.size() == 1 || value < min_value) min_value = value;
+	if (samples.size() == 1 || value > max_value) max_value = value;
+}
+
+void SampleStatistics::reset()
+{
+	samples.clear();
+	mean_value = 0.0;
+	m2 = 0.0;
+	min_value = 0.0;
+	max_value = 0.0;
+}
+
+double SampleStatistics::stddev() const
+{
+	if (samples.size() < 2) return 0.0;
+	return std::sqrt(m2 / (samples.size() - 1));
+}
+
+double SampleStatistics::quantile(std::vector<double> values, double fraction)
+{
+	if (values.empty()) return 0.0;
+	std::size_t middle = static_cast<std::size_t>(fraction * (values.size() - 1));
+	std::nth_element(values.begin(), values.begin() + middle, values.end());
+	double lower = values[middle];
+	if (fraction * (values.size() - 1) == middle) return lower;
+	double upper = *std::min_element(values.begin() + middle + 1, values.end());
+	return (lower + upper) / 2.0;
+}
+
+double SampleStatistics::median() const
+{
+	return quantile(samples, 0.5);
+}
+
+// Two-sided 95% quantile of Student's t distribution
+double SampleStatistics::studentT95(std::size_t degrees_of_freedom)
+{
+	static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+								   2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+								   2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+								   2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+	const std::size_t entries = sizeof(table) / sizeof(table[0]);
+	if (degrees_of_freedom == 0) return 0.0;
+	if (degrees_of_freedom <= entries) return table[degrees_of_freedom - 1];
+	return 1.960;
+}
+
+double SampleStatistics::confidenceInterval95() const
+{
+	if (samples.size() < 2) return 0.0;
+	return studentT95(samples.size() - 1) * stddev() / std::sqrt(static_cast<double>(samples.size()));
+}
+
+// Modified z-score above 3.5 (Iglewicz and Hoaglin), robust against the outliers themselves
+unsigned int SampleStatistics::outliers() const
+{
+	if (samples.size() < 3) return 0;
+	double med = median();
+	std::vector<double> deviations;
+	for (double value : samples)
+	{
+		deviations.push_back(std::fabs(value - med));
+	}
+	double mad = quantile(deviations, 0.5);
+	unsigned int count = 0;
+	for (double deviation : deviations)
+	{
+		if (mad > 0.0 ? 0.6745 * deviation / mad > 3.5 : deviation > 0.0) count++;
+	}
+	return count;
+}
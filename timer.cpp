@@ -1,72 +1,311 @@
 #include "performance.h"
+#include <algorithm>
+
+namespace
+{
+	// Queued to a DuplexChecker after the block numbers
+	constexpr unsigned int END_OF_BATCH {std::numeric_limits<unsigned int>::max()};
+	constexpr unsigned int STOP_CHECKER {END_OF_BATCH - 1};
+}
 
 // INTERFACE
-void ITimer::performActionOnData(unsigned char *data, unsigned int pattern_size)
+std::shared_ptr<const unsigned char> ITimer::goldenPattern(unsigned int pattern_size)
 {
+	auto golden = pattern_cache.getPattern(mode, pattern, pattern_size);
+	if (golden) return golden;
+
+	TRACE_SCOPE("pattern generation");
+	DLOG(WARNING) << "Pattern of " << pattern_size << " B does not fit into cache";
+	std::shared_ptr<unsigned char> data(new unsigned char[pattern_size],
+										std::default_delete<unsigned char[]>());
 	DataGenerator datagen(mode, pattern, pattern_size);
+	datagen.fillArrayWithData(data.get());
+	return data;
+}
+
+void ITimer::performActionOnData(unsigned char *data, unsigned int pattern_size)
+{
 	if (check_for_errors)
 	{
-		errors += datagen.checkArrayForErrors(data);
+		TRACE_SCOPE("verification");
+		auto golden = pattern_cache.getPattern(mode, pattern, pattern_size);
+		errors += verifier.verify(mode, pattern, data, pattern_size, golden.get(), &asic_errors, &error_report);
+		error_report.iteration++;
 	}
 	else
 	{
+		TRACE_SCOPE("pattern generation");
+		DataGenerator datagen(mode, pattern, pattern_size);
 		datagen.fillArrayWithData(data);
 	}
 }
 
 void ITimer::prepareForTransfer()
 {
+	TRACE_SCOPE("device control");
 	pc_duration_total = std::chrono::nanoseconds::zero();
 	errors = 0;
+	asic_errors = AsicFieldErrors{0, 0, 0, 0};
+	error_report.reset();
+	window_triggers = 0;
 	dev->SetWireInValue(PATTERN_TO_GENERATE, pattern);
 	dev->UpdateWireIns();
 	dev->ActivateTriggerIn(TRIGGER, RESET);
 }
 
+// Drops everything the warm-up iterations left in the counters and accumulators
+void ITimer::startMeasuredIterations()
+{
+	if (warmup_iterations > 0)
+	{
+		DLOG(INFO) << warmup_iterations << " warm-up iterations done";
+		dev->ActivateTriggerIn(TRIGGER, RESET);
+		pc_duration_total = std::chrono::nanoseconds::zero();
+		errors = 0;
+		asic_errors = AsicFieldErrors{0, 0, 0, 0};
+		error_report.reset();
+		window_triggers = 0;
+	}
+	pc_samples.reset();
+	fpga_samples.reset();
+	fpga_counts_recorded = 0;
+}
+
+// Clock counts are cumulative until RESET, so one iteration is the difference to the last reading.
+// Must be called outside the timing window
+void ITimer::recordFpgaIteration()
+{
+	TRACE_SCOPE("device control");
+	uint64_t counts = okdev::readClockCounts(dev);
+	fpga_samples.add((counts - fpga_counts_recorded) / FIFO_CLOCK);
+	fpga_counts_recorded = counts;
+}
+
+// The PC window opens before the START_TIMER call and closes after the STOP_TIMER call returns
+void ITimer::startTimer()
+{
+	timer_start = PerfClock::now();
+	dev->ActivateTriggerIn(TRIGGER, START_TIMER);
+	window_triggers++;
+}
+
+// The pipe calls of the window are traced as one span once it closed
+void ITimer::stopTimer()
+{
+	dev->ActivateTriggerIn(TRIGGER, STOP_TIMER);
+	timer_stop = PerfClock::now();
+	window_triggers++;
+	PhaseTracer::record("pipe transfer", timer_start, timer_stop);
+}
+
+void ITimer::readPipe(unsigned char *data, unsigned int size)
+{
+	const unsigned int chunk = (chunk_size == 0) ? size : chunk_size;
+	for (unsigned int offset = 0; offset < size; offset += chunk)
+	{
+		long length = std::min(chunk, size - offset);
+		long transferred = pipe_block_size ?
+			dev->ReadFromBlockPipeOut(PIPE_OUT, pipe_block_size, length, data + offset) :
+			dev->ReadFromPipeOut(PIPE_OUT, length, data + offset);
+		if (transferred < 0) LOG(ERROR) << "Pipe read failed: " << dev->GetErrorString(transferred);
+	}
+}
+
+void ITimer::writePipe(unsigned char *data, unsigned int size)
+{
+	const unsigned int chunk = (chunk_size == 0) ? size : chunk_size;
+	for (unsigned int offset = 0; offset < size; offset += chunk)
+	{
+		long length = std::min(chunk, size - offset);
+		long transferred = pipe_block_size ?
+			dev->WriteToBlockPipeIn(PIPE_IN, pipe_block_size, length, data + offset) :
+			dev->WriteToPipeIn(PIPE_IN, length, data + offset);
+		if (transferred < 0) LOG(ERROR) << "Pipe write failed: " << dev->GetErrorString(transferred);
+	}
+}
+
 // READ
 void Read::performTimer(unsigned int pattern_size, unsigned int iterations)
 {
 	prepareForTransfer();
-	unsigned char *data = new unsigned char[pattern_size];
-	for (unsigned int i=0; i<iterations; i++)
+	unsigned char *data = buffer_pool.acquire(pattern_size);
+	for (unsigned int i=0; i<warmup_iterations+iterations; i++)
 	{
 		DLOG(INFO) << "Current iteration: " << i;
+		if (i == warmup_iterations) startMeasuredIterations();
 		dev->ActivateTriggerIn(TRIGGER, RESET_PATTERN);
-		timer_start = std::chrono::system_clock::now();
-		dev->ActivateTriggerIn(TRIGGER, START_TIMER);
+		startTimer();
 
-		dev->ReadFromPipeOut(PIPE_OUT, pattern_size, data);
+		readPipe(data, pattern_size);
 
-		dev->ActivateTriggerIn(TRIGGER, STOP_TIMER);
-		timer_stop = std::chrono::system_clock::now();
+		stopTimer();
 
+		if (i < warmup_iterations) continue;
 		pc_duration_total += (timer_stop - timer_start);
+		pc_samples.add(std::chrono::duration<double, std::micro>(timer_stop - timer_start).count());
+		recordFpgaIteration();
+		performActionOnData(data, pattern_size);
+	}
+	buffer_pool.release(data);
+}
+
+// PIPELINED READ
+void PipelinedRead::verifyFilledBuffers(unsigned int pattern_size)
+{
+	PhaseTracer::nameThread("read verifier");
+	for (unsigned char *data = filled_buffers.pop(); data != nullptr; data = filled_buffers.pop())
+	{
 		performActionOnData(data, pattern_size);
+		free_buffers.push(data);
+	}
+}
+
+void PipelinedRead::performTimer(unsigned int pattern_size, unsigned int iterations)
+{
+	prepareForTransfer();
+	std::vector<unsigned char *> data_v;
+	for (unsigned int b=0; b<buffers; b++)
+	{
+		data_v.push_back(buffer_pool.acquire(pattern_size));
+		free_buffers.push(data_v.back());
+	}
+	std::thread verifier(&PipelinedRead::verifyFilledBuffers, this, pattern_size);
+
+	for (unsigned int i=0; i<warmup_iterations+iterations; i++)
+	{
+		DLOG(INFO) << "Current iteration: " << i;
+		if (i == warmup_iterations) startMeasuredIterations();
+		unsigned char *data = free_buffers.pop();
+		dev->ActivateTriggerIn(TRIGGER, RESET_PATTERN);
+		startTimer();
+
+		readPipe(data, pattern_size);
+
+		stopTimer();
+
+		if (i < warmup_iterations)
+		{
+			// Warm-up data is not verified, so the errors counter is never touched after the reset
+			free_buffers.push(data);
+			continue;
+		}
+		pc_duration_total += (timer_stop - timer_start);
+		pc_samples.add(std::chrono::duration<double, std::micro>(timer_stop - timer_start).count());
+		recordFpgaIteration();
+		filled_buffers.push(data);
+	}
+	filled_buffers.push(nullptr);
+	verifier.join();
+
+	for (auto data : data_v)
+	{
+		buffer_pool.release(data);
 	}
-	delete[] data;
 }
 
 // WRITE
 void Write::performTimer(unsigned int pattern_size, unsigned int iterations)
 {
 	prepareForTransfer();
-	unsigned char *data = new unsigned char[pattern_size];
-	performActionOnData(data, pattern_size);
-	timer_start = std::chrono::system_clock::now();
-	dev->ActivateTriggerIn(TRIGGER, START_TIMER);
+	auto golden = goldenPattern(pattern_size);
+	unsigned char *data = const_cast<unsigned char *>(golden.get());
+	for (unsigned int i=0; i<warmup_iterations; i++)
+	{
+		dev->ActivateTriggerIn(TRIGGER, RESET_PATTERN);
+		writePipe(data, pattern_size);
+	}
+	startMeasuredIterations();
+
+	// All iterations share one FPGA timing window, so only PC samples are taken per iteration
+	startTimer();
+	auto iteration_start = timer_start;
 	for (unsigned int i=0; i<iterations; i++)
 	{
 		dev->ActivateTriggerIn(TRIGGER, RESET_PATTERN);
-		dev->WriteToPipeIn(PIPE_IN, pattern_size, data);
+		window_triggers++;
+		writePipe(data, pattern_size);
+		auto iteration_stop = PerfClock::now();
+		pc_samples.add(std::chrono::duration<double, std::micro>(iteration_stop - iteration_start).count());
+		iteration_start = iteration_stop;
 	}
-	dev->ActivateTriggerIn(TRIGGER, STOP_TIMER);
-	timer_stop = std::chrono::system_clock::now();
+	stopTimer();
+	pc_duration_total = timer_stop - timer_start;
+}
+
+// STREAMING WRITE
+// The checker is reset again after the warm-up, so the measured stream restarts at offset 0
+void StreamingWrite::produceChunks(unsigned int pattern_size, unsigned int chunks)
+{
+	PhaseTracer::nameThread("write producer");
+	for (unsigned int i=0; i<chunks; i++)
+	{
+		unsigned char *data = free_buffers.pop();
+		TRACE_SCOPE("pattern generation");
+		uint64_t chunk = (i < warmup_iterations) ? i : i - warmup_iterations;
+		auto generation_start = PerfClock::now();
+		DataGenerator datagen(mode, pattern, pattern_size, chunk * pattern_size);
+		datagen.fillArrayWithData(data);
+		if (i >= warmup_iterations) generation_duration += PerfClock::now() - generation_start;
+		filled_buffers.push(data);
+	}
+}
+
+void StreamingWrite::performTimer(unsigned int pattern_size, unsigned int iterations)
+{
+	prepareForTransfer();
+	generation_duration = std::chrono::nanoseconds::zero();
+	link_duration = std::chrono::nanoseconds::zero();
+	std::vector<unsigned char *> data_v;
+	for (unsigned int b=0; b<buffers; b++)
+	{
+		data_v.push_back(buffer_pool.acquire(pattern_size));
+		free_buffers.push(data_v.back());
+	}
+	std::thread producer(&StreamingWrite::produceChunks, this, pattern_size, warmup_iterations + iterations);
+
+	dev->ActivateTriggerIn(TRIGGER, RESET_PATTERN);
+	for (unsigned int i=0; i<warmup_iterations; i++)
+	{
+		unsigned char *data = filled_buffers.pop();
+		writePipe(data, pattern_size);
+		free_buffers.push(data);
+	}
+	startMeasuredIterations();
+	dev->ActivateTriggerIn(TRIGGER, RESET_PATTERN);
+
+	startTimer();
+	auto iteration_start = timer_start;
+	for (unsigned int i=0; i<iterations; i++)
+	{
+		unsigned char *data = filled_buffers.pop();
+		auto link_start = PerfClock::now();
+		writePipe(data, pattern_size);
+		auto iteration_stop = PerfClock::now();
+		link_duration += iteration_stop - link_start;
+		free_buffers.push(data);
+		pc_samples.add(std::chrono::duration<double, std::micro>(iteration_stop - iteration_start).count());
+		iteration_start = iteration_stop;
+	}
+	stopTimer();
 	pc_duration_total = timer_stop - timer_start;
-	delete[] data;
+	producer.join();
+
+	for (auto data : data_v)
+	{
+		buffer_pool.release(data);
+	}
+
+	// Whichever side was busy longer limited the stream
+	bottleneck = (generation_duration > link_duration) ? "generator" : "link";
+	// A chunk can be generated faster than the clock resolution
+	if (generation_duration.count() > 0) generator_speed = static_cast<double>(pattern_size) * iterations * 1000000 / generation_duration.count();
+	else generator_speed = 0;
+	LOG(INFO) << "Streaming write: generation " << generation_duration.count() << " us, link "
+			  << link_duration.count() << " us, bottleneck: " << bottleneck;
 }
 
 // DUPLEX
-void Duplex::checkIfReceivedEqualsSend(unsigned char *send_data, unsigned char *received_data)
+void Duplex::checkIfReceivedEqualsSend(unsigned char *send_data, unsigned char *received_data, uint64_t offset)
 {
 	if (std::equal(send_data, send_data + block_size, received_data))
 	{
@@ -76,37 +315,144 @@ void Duplex::checkIfReceivedEqualsSend(unsigned char *send_data, unsigned char *
 	{
 		DLOG(ERROR) << "Duplex: send data is NOT equal to received data";
 		errors += 1;
+		error_report.compare(received_data, send_data, block_size, offset, 4);
 	}
 }
 
 void Duplex::performTimer(unsigned int pattern_size, unsigned int iterations)
 {
 	prepareForTransfer();
-	unsigned char *data = new unsigned char[pattern_size];
-	performActionOnData(data, pattern_size);
-	unsigned char *received_data = new unsigned char[block_size];
+	auto golden = goldenPattern(pattern_size);
+	unsigned char *data = const_cast<unsigned char *>(golden.get());
+	unsigned char *received_data = buffer_pool.acquire(block_size);
 	unsigned char *send_data;
-	for (unsigned int i=0; i<iterations; i++)
+	for (unsigned int i=0; i<warmup_iterations+iterations; i++)
 	{
+		if (i == warmup_iterations)
+		{
+			startMeasuredIterations();
+			latency.reset();
+		}
+		std::chrono::duration<double, std::micro> iteration_duration{0};
+		error_report.iteration = i - std::min(i, warmup_iterations);
 		for (unsigned int j = 0; j < pattern_size; j+=block_size)
 		{
 			send_data = data + j;
 
-			timer_start = std::chrono::system_clock::now();
-			dev->ActivateTriggerIn(TRIGGER, START_TIMER);
+			startTimer();
 
+			auto round_trip_start = PerfClock::now();
 			dev->WriteToPipeIn(PIPE_IN, block_size, send_data);
 			dev->ReadFromPipeOut(PIPE_OUT, block_size, received_data);
+			latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				PerfClock::now() - round_trip_start).count());
 
-			dev->ActivateTriggerIn(TRIGGER, STOP_TIMER);
-			timer_stop = std::chrono::system_clock::now();
-			pc_duration_total += (timer_stop - timer_start);
+			stopTimer();
+			iteration_duration += (timer_stop - timer_start);
 
 			// Error checking
-			checkIfReceivedEqualsSend(send_data, received_data);
+			checkIfReceivedEqualsSend(send_data, received_data, j);
+		}
+		if (i < warmup_iterations) continue;
+		pc_duration_total += iteration_duration;
+		pc_samples.add(iteration_duration.count());
+		recordFpgaIteration();
+	}
+
+	buffer_pool.release(received_data);
+}
+
+// STREAMING DUPLEX
+DuplexChecker::DuplexChecker(const unsigned char *sent, const unsigned char *received, unsigned int block_size,
+							 ErrorReport &report) :
+sent{sent}, received{received}, block_size{block_size}, report(report), mismatches{0}
+{
+	worker = std::thread(&DuplexChecker::checkBlocks, this);
+}
+
+DuplexChecker::~DuplexChecker()
+{
+	blocks.push(STOP_CHECKER);
+	worker.join();
+}
+
+void DuplexChecker::check(unsigned int block)
+{
+	blocks.push(block);
+}
+
+unsigned int DuplexChecker::wait()
+{
+	blocks.push(END_OF_BATCH);
+	return batches.pop();
+}
+
+void DuplexChecker::checkBlocks()
+{
+	PhaseTracer::nameThread("duplex checker");
+	for (;;)
+	{
+		unsigned int block = blocks.pop();
+		if (block == STOP_CHECKER) return;
+		if (block == END_OF_BATCH)
+		{
+			batches.push(mismatches);
+			mismatches = 0;
+			continue;
+		}
+		TRACE_SCOPE("verification");
+		const std::size_t offset = static_cast<std::size_t>(block) * block_size;
+		if (std::equal(sent + offset, sent + offset + block_size, received + offset)) continue;
+		mismatches++;
+		report.compare(received + offset, sent + offset, block_size, offset, 4);
+	}
+}
+
+void StreamingDuplex::performTimer(unsigned int pattern_size, unsigned int iterations)
+{
+	prepareForTransfer();
+	auto golden = goldenPattern(pattern_size);
+	unsigned char *data = const_cast<unsigned char *>(golden.get());
+	const unsigned int blocks = pattern_size / block_size;
+	// Every block of an iteration gets its own slot, so a read never overwrites a block being checked
+	unsigned char *received_data = buffer_pool.acquire(static_cast<std::size_t>(blocks) * block_size);
+	write_started.resize(blocks);
+	{
+		DuplexChecker checker(data, received_data, block_size, error_report);
+		for (unsigned int i=0; i<warmup_iterations+iterations; i++)
+		{
+			if (i == warmup_iterations)
+			{
+				startMeasuredIterations();
+				latency.reset();
+			}
+			error_report.iteration = i - std::min(i, warmup_iterations);
+			unsigned int written = 0;
+
+			startTimer();
+
+			for (unsigned int b = 0; b < blocks; b++)
+			{
+				for (; written < blocks && written - b < in_flight; written++)
+				{
+					write_started[written] = PerfClock::now();
+					dev->WriteToPipeIn(PIPE_IN, block_size, data + static_cast<std::size_t>(written) * block_size);
+				}
+				dev->ReadFromPipeOut(PIPE_OUT, block_size, received_data + static_cast<std::size_t>(b) * block_size);
+				latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					PerfClock::now() - write_started[b]).count());
+				checker.check(b);
+			}
+
+			stopTimer();
+			errors += checker.wait();
+
+			if (i < warmup_iterations) continue;
+			pc_duration_total += (timer_stop - timer_start);
+			pc_samples.add(std::chrono::duration<double, std::micro>(timer_stop - timer_start).count());
+			recordFpgaIteration();
 		}
 	}
 
-	delete[] received_data;
-	delete[] data;
+	buffer_pool.release(received_data);
 }
@@ -0,0 +1,209 @@
+#include "performance.h"
+#include <iomanip>
+
+namespace
+{
+	// Per thread cap of stored trace events, totals keep counting past it
+	constexpr std::size_t TRACE_MAX_EVENTS {1 << 20};
+
+	struct PhaseTotals
+	{
+		uint64_t calls;
+		double total_us, self_us;
+	};
+
+	struct TraceEvent
+	{
+		const char *name;
+		int64_t start_ns, duration_ns;
+	};
+
+	// Written only by the thread using it, read once all threads finished
+	struct ThreadTrace
+	{
+		unsigned int id;
+		std::string name;
+		bool active;
+		std::vector<double> child_us;
+		std::map<const char *, PhaseTotals> totals;
+		std::vector<TraceEvent> events;
+		uint64_t dropped_events;
+	};
+
+	std::mutex threads_mutex;
+	std::vector<std::unique_ptr<ThreadTrace>> threads;
+	PerfClock::time_point origin;
+	bool keep_events;
+
+	// Hands the trace back when its thread exits
+	struct ThreadSlot
+	{
+		ThreadTrace *trace = nullptr;
+
+		~ThreadSlot()
+		{
+			if (trace == nullptr) return;
+			std::lock_guard<std::mutex> lock(threads_mutex);
+			trace->active = false;
+		}
+	};
+
+	thread_local ThreadSlot slot;
+
+	// Short-lived threads with the name of a finished one continue its track, unnamed threads
+	// share the finished unnamed tracks
+	ThreadTrace *acquireTrace(const std::string &name)
+	{
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		for (auto &trace : threads)
+		{
+			if (!trace->active && trace->name == name)
+			{
+				trace->active = true;
+				return trace.get();
+			}
+		}
+		unsigned int id = threads.size() + 1;
+		threads.emplace_back(new ThreadTrace{id, name, true, {}, {}, {}, 0});
+		return threads.back().get();
+	}
+
+	ThreadTrace &currentThread()
+	{
+		if (slot.trace == nullptr) slot.trace = acquireTrace("");
+		return *slot.trace;
+	}
+
+	void addSpan(ThreadTrace &trace, const char *name, PerfClock::time_point start, PerfClock::time_point stop,
+				 double child_us)
+	{
+		double duration_us = std::chrono::duration<double, std::micro>(stop - start).count();
+		if (!trace.child_us.empty()) trace.child_us.back() += duration_us;
+
+		PhaseTotals &totals = trace.totals[name];
+		totals.calls++;
+		totals.total_us += duration_us;
+		totals.self_us += duration_us - child_us;
+
+		if (!keep_events) return;
+		if (trace.events.size() >= TRACE_MAX_EVENTS)
+		{
+			trace.dropped_events++;
+			return;
+		}
+		trace.events.push_back({name, std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin).count(),
+								std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count()});
+	}
+}
+
+std::atomic<bool> PhaseTracer::enabled {false};
+
+void PhaseTracer::enable(bool keep)
+{
+	origin = PerfClock::now();
+	keep_events = keep;
+	enabled = true;
+	nameThread("main");
+	LOG(INFO) << "Phase timing enabled" << (keep ? " with timeline trace" : "");
+}
+
+void PhaseTracer::nameThread(const std::string &name)
+{
+	if (!enabled.load(std::memory_order_relaxed)) return;
+	if (slot.trace == nullptr) slot.trace = acquireTrace(name);
+	else slot.trace->name = name;
+}
+
+PerfClock::time_point PhaseTracer::begin()
+{
+	currentThread().child_us.push_back(0.0);
+	return PerfClock::now();
+}
+
+// Self time leaves out the nested scopes, so the self column of the summary adds up per thread
+void PhaseTracer::end(const char *name, PerfClock::time_point start)
+{
+	PerfClock::time_point stop = PerfClock::now();
+	ThreadTrace &trace = currentThread();
+	double child_us = trace.child_us.back();
+	trace.child_us.pop_back();
+	addSpan(trace, name, start, stop, child_us);
+}
+
+void PhaseTracer::record(const char *name, PerfClock::time_point start, PerfClock::time_point stop)
+{
+	if (!enabled.load(std::memory_order_relaxed)) return;
+	addSpan(currentThread(), name, start, stop, 0.0);
+}
+
+void PhaseTracer::printSummary()
+{
+	if (!enabled) return;
+	const double wall_us = std::chrono::duration<double, std::micro>(PerfClock::now() - origin).count();
+
+	std::map<std::string, PhaseTotals> phases;
+	for (const auto &trace : threads)
+	{
+		for (const auto &entry : trace->totals)
+		{
+			PhaseTotals &phase = phases[entry.first];
+			phase.calls += entry.second.calls;
+			phase.total_us += entry.second.total_us;
+			phase.self_us += entry.second.self_us;
+		}
+	}
+	std::vector<std::pair<std::string, PhaseTotals>> sorted(phases.begin(), phases.end());
+	std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, PhaseTotals> &a,
+											   const std::pair<std::string, PhaseTotals> &b)
+	{
+		return a.second.self_us > b.second.self_us;
+	});
+
+	// Phases of concurrent threads overlap, so the shares may add up to more than 100 %
+	std::ostringstream summary;
+	summary << std::fixed << std::setprecision(3) << "Phase summary over " << wall_us / 1e6
+			<< " s wall time (summed over " << threads.size() << " threads):\n"
+			<< std::left << std::setw(24) << "phase" << std::right << std::setw(10) << "calls"
+			<< std::setw(14) << "total [s]" << std::setw(14) << "self [s]" << std::setw(10) << "self %";
+	for (const auto &phase : sorted)
+	{
+		summary << '\n' << std::left << std::setw(24) << phase.first << std::right
+				<< std::setw(10) << phase.second.calls << std::setw(14) << phase.second.total_us / 1e6
+				<< std::setw(14) << phase.second.self_us / 1e6 << std::setw(9) << std::setprecision(1)
+				<< 100.0 * phase.second.self_us / wall_us << '%' << std::setprecision(3);
+	}
+	LOG(INFO) << summary.str();
+}
+
+// Chrome trace event format, loads in chrome://tracing and ui.perfetto.dev
+void PhaseTracer::writeTrace(const std::string &path)
+{
+	if (!enabled || !keep_events) return;
+	std::ofstream out(path, std::ios::trunc);
+	if (!out.good()) LOG(FATAL) << "Unable to open " << path;
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	uint64_t dropped_events = 0;
+	for (const auto &trace : threads)
+	{
+		out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+			<< trace->id << ",\"args\":{\"name\":";
+		writeJsonString(out, trace->name.empty() ? "thread " + std::to_string(trace->id) : trace->name);
+		out << "}}";
+		first = false;
+		for (const auto &event : trace->events)
+		{
+			out << ",\n{\"name\":";
+			writeJsonString(out, event.name);
+			out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << trace->id << ",\"ts\":" << event.start_ns / 1000
+				<< '.' << std::setw(3) << std::setfill('0') << event.start_ns % 1000 << ",\"dur\":"
+				<< event.duration_ns / 1000 << '.' << std::setw(3) << event.duration_ns % 1000
+				<< std::setfill(' ') << '}';
+		}
+		dropped_events += trace->dropped_events;
+	}
+	out << "\n]}\n";
+	if (dropped_events) LOG(WARNING) << dropped_events << " trace events over the per thread cap were dropped";
+	LOG(INFO) << "Timeline trace saved to " << path;
+}
@@ -1,11 +1,12 @@
 #include "performance.h"
+#include <algorithm>
 #include <limits>
+#include <set>
 
 // #undef max // Uncomment for Windows
 
 void TransferController::saveResults()
 {
-	Results results(dev, cfgs);
 	results.block_size = block_size;
 	results.depth = depth;
 	results.errors = errors;
@@ -16,33 +17,130 @@ void TransferController::saveResults()
 	results.memory = memory;
 	results.pattern = pattern;
 	results.pc_duration_total = pc_duration_total;
-	results.saveResultsToFile();
+	results.latency = latency;
+	results.pc_samples = pc_samples;
+	results.fpga_samples = fpga_samples;
+	results.asic_errors = asic_errors;
+	results.overhead = overhead;
+	results.window_triggers = window_triggers;
+	results.bottleneck = bottleneck;
+	results.generator_speed = generator_speed;
+	results.chunk_size = (transfer_mode == DUPLEX) ? block_size : std::min(pattern_size, chunk_size ? chunk_size : pattern_size);
+	point_records.push_back(results.createRecord());
+	point_records.back().setInteger("ControlRoundTrips", control.round_trips - round_trips_start);
+	sink.pushHistogram(current_point, stat_iteration, latency);
+	TRACE_SCOPE("error report");
+	unsigned int report_id = error_reports.write(serial, current_point, stat_iteration, errors, error_report);
+	if (report_id) point_records.back().setInteger("ErrorReport", report_id);
+	pc_speeds.add(results.pc_speed);
+	fpga_speeds.add(results.fpga_speed);
+}
+
+// Rows of a test point are written together, once the number of repetitions is known
+void TransferController::pushPointResults()
+{
+	for (auto &record : point_records)
+	{
+		record.setInteger("Repetitions", point_records.size() + restored_iterations);
+		sink.push(std::move(record));
+	}
+	point_records.clear();
+}
+
+bool TransferController::speedsConverged()
+{
+	if (cfgs.ci_target <= 0.0 || pc_speeds.count() < cfgs.min_statistic_iter) return false;
+	for (const SampleStatistics *speeds : {&pc_speeds, &fpga_speeds})
+	{
+		if (speeds->mean() <= 0.0) continue;
+		if (speeds->confidenceInterval95() / speeds->mean() >= cfgs.ci_target) return false;
+	}
+	return true;
+}
+
+double TransferController::pcSpeed()
+{
+	return static_cast<double>(pattern_size) * cfgs.iterations /
+		   std::chrono::duration<double>(pc_duration_total).count();
+}
+
+void TransferController::configureTimer(ITimer &timer)
+{
+	timer.warmup_iterations = cfgs.warmup_iterations;
+	timer.chunk_size = chunk_size;
+	timer.pipe_block_size = cfgs.transfer_block_size;
+	timer.error_report = ErrorReport{error_report.maxBytes()};
+}
+
+void TransferController::collectTimerResults(const ITimer &timer)
+{
+	pc_duration_total = timer.pc_duration_total;
+	errors = timer.errors;
+	asic_errors = timer.asic_errors;
+	error_report = timer.error_report;
+	pc_samples = timer.pc_samples;
+	fpga_samples = timer.fpga_samples;
+	window_triggers = timer.window_triggers;
 }
 
 void TransferController::performDuplexTimer()
 {
+	if (cfgs.duplex_mode == "streaming")
+	{
+		DLOG(INFO) << "Setting streaming duplex timer";
+		StreamingDuplex duplex_timer(dev, pattern_cache, verifier, buffer_pool, cfgs.mode_m.at(mode), cfgs.pattern_m.at(pattern),
+									 block_size, cfgs.duplex_in_flight);
+		configureTimer(duplex_timer);
+		duplex_timer.performTimer(pattern_size, cfgs.iterations);
+		collectTimerResults(duplex_timer);
+		latency = duplex_timer.latency;
+		return;
+	}
 	DLOG(INFO) << "Setting duplex timer";
-	Duplex duplex_timer(dev, cfgs.mode_m[mode], cfgs.pattern_m[pattern], block_size);
+	Duplex duplex_timer(dev, pattern_cache, verifier, buffer_pool, cfgs.mode_m.at(mode), cfgs.pattern_m.at(pattern), block_size);
+	configureTimer(duplex_timer);
 	duplex_timer.performTimer(pattern_size, cfgs.iterations);
-	pc_duration_total = duplex_timer.pc_duration_total;
-	errors = duplex_timer.errors;
+	collectTimerResults(duplex_timer);
+	latency = duplex_timer.latency;
 }
 
 void TransferController::performWriteTimer()
 {
+	if (cfgs.write_mode == "streaming")
+	{
+		DLOG(INFO) << "Setting streaming write timer";
+		StreamingWrite write_timer(dev, pattern_cache, verifier, buffer_pool, cfgs.mode_m.at(mode), cfgs.pattern_m.at(pattern),
+								   cfgs.write_buffers);
+		configureTimer(write_timer);
+		write_timer.performTimer(pattern_size, cfgs.iterations);
+		collectTimerResults(write_timer);
+		bottleneck = write_timer.bottleneck;
+		generator_speed = write_timer.generator_speed;
+		return;
+	}
 	DLOG(INFO) << "Setting write timer";
-	Write write_timer(dev, cfgs.mode_m[mode], cfgs.pattern_m[pattern]);
+	Write write_timer(dev, pattern_cache, verifier, buffer_pool, cfgs.mode_m.at(mode), cfgs.pattern_m.at(pattern));
+	configureTimer(write_timer);
 	write_timer.performTimer(pattern_size, cfgs.iterations);
-	pc_duration_total = write_timer.pc_duration_total;
+	collectTimerResults(write_timer);
 }
 
 void TransferController::performReadTimer()
 {
+	if (cfgs.read_buffers > 1)
+	{
+		DLOG(INFO) << "Setting pipelined read timer";
+		PipelinedRead read_timer(dev, pattern_cache, verifier, buffer_pool, cfgs.mode_m.at(mode), cfgs.pattern_m.at(pattern), cfgs.read_buffers);
+		configureTimer(read_timer);
+		read_timer.performTimer(pattern_size, cfgs.iterations);
+		collectTimerResults(read_timer);
+		return;
+	}
 	DLOG(INFO) << "Setting read timer";
-	Read read_timer(dev, cfgs.mode_m[mode], cfgs.pattern_m[pattern]);
+	Read read_timer(dev, pattern_cache, verifier, buffer_pool, cfgs.mode_m.at(mode), cfgs.pattern_m.at(pattern));
+	configureTimer(read_timer);
 	read_timer.performTimer(pattern_size, cfgs.iterations);
-	pc_duration_total = read_timer.pc_duration_total;
-	errors = read_timer.errors;
+	collectTimerResults(read_timer);
 }
 
 void TransferController::runTestBasedOnParameters()
@@ -54,6 +152,10 @@ void TransferController::runTestBasedOnParameters()
 	DLOG(INFO) << "Current size: " << pattern_size;
 	DLOG(INFO) << "Current pattern: " << pattern;
 
+	TRACE_SCOPE("measurement");
+	round_trips_start = control.round_trips;
+	latency.reset();
+	bottleneck.clear();
 	if (transfer_mode != DUPLEX)
 	{
 		if (transfer_direction == READ)
@@ -72,161 +174,241 @@ void TransferController::runTestBasedOnParameters()
 	saveResults();
 }
 
-void TransferController::runOnSpecificPattern()
+void TransferController::runTestPoint(const TestPoint &point)
 {
+	TRACE_SCOPE("test point");
 	okdev::checkIfOpen(dev);
-	for (const auto &pattern : cfgs.pattern_v)
+	current_point = point;
+	mode = point.mode;
+	direction = point.direction;
+	memory = point.memory;
+	depth = point.depth;
+	pattern_size = point.pattern_size;
+	block_size = point.block_size;
+	pattern = point.pattern;
+	transfer_mode = cfgs.mode_m.at(mode);
+	transfer_direction = cfgs.direction_m.at(direction);
+	chunk_size = cfgs.transfer_chunk_size ? cfgs.transfer_chunk_size :
+				 tuning.lookup(serial, mode, direction);
+	pc_speeds.reset();
+	fpga_speeds.reset();
+	restored_iterations = 0;
+
+	for (unsigned int i = 1; i <= cfgs.statistic_iter; i++)
 	{
-		if (transfer_mode != NONSYM && cfgs.pattern_m[pattern] == ASIC)
+		if (completed.contains(point, i))
 		{
-			DLOG(INFO) << "Incompatible asic pattern with current mode. Skipping.";
+			restored_iterations++;
+			DLOG(INFO) << "Statistical iteration " << i << " already recorded. Skipping.";
 			continue;
 		}
-		this->pattern = pattern;
-		DLOG(INFO) << "Current pattern: " << pattern;
-		for (unsigned int i = 1; i <= cfgs.statistic_iter; i++)
+		stat_iteration = i;
+		DLOG(INFO) << "Current statistical iteration: " << i;
+		runTestBasedOnParameters();
+		if (speedsConverged())
 		{
-			stat_iteration = i;
-			DLOG(INFO) << "Current statistical iteration: " << i;
-			runTestBasedOnParameters();
+			LOG(INFO) << "Speed confidence interval below target after " << i << " statistical iterations";
+			break;
 		}
 	}
+	pushPointResults();
 }
 
-void TransferController::runOnSpecificPatternSize()
+double TransferController::measurePoint(const TestPoint &point)
 {
-	if (transfer_mode == DUPLEX)
-	{
-		for (const auto &block_size : cfgs.block_size_v)
-		{
-			this->block_size = block_size;
-			DLOG(INFO) << "Duplex block size set to: " << block_size;
-			runOnSpecificPattern();
-		}
-	}
-	else
-	{
-		block_size = pattern_size;
-		DLOG(INFO) << "Non duplex mode. Block size will be the same as pattern size";
-		runOnSpecificPattern();
-	}
+	loadBitfile(point.bitfile);
+	runTestPoint(point);
+	return pc_speeds.mean();
 }
 
-void TransferController::setupFPGA()
+// Searches the size axis of one configuration instead of measuring every size.
+// Coarse steps go to the first listed size at least 4x larger, until two steps in a row gain
+// less than the tolerance. Bisection between the last slow and the first plateau size then
+// narrows the knee. A series that never levels off reports no knee.
+void TransferController::runAdaptiveSeries(const std::vector<TestPoint> &series)
 {
-	std::string bitfiles = cfgs.bitfiles_path + mode + "/";
-	DLOG(INFO) << "Path to bitfiles for current transfer mode: " << bitfiles;
-	std::string bitfile_name = direction + "_" + mode + "_fifo_" + memory + \
-							   "_" + std::to_string(depth) + ".bit";
-	std::string bitfile_to_load = bitfiles + bitfile_name;
-	okdev::setupFPGA(dev, bitfile_to_load);
-}
+	const double tolerance = cfgs.adaptive_tolerance;
+	const unsigned int step_ratio = 4;
+	std::vector<double> speeds(series.size(), 0.0);
+	std::vector<bool> measured(series.size(), false);
+	std::size_t measured_count = 0;
+	auto measure = [&](std::size_t i)
+	{
+		speeds[i] = measurePoint(series[i]);
+		measured[i] = true;
+		measured_count++;
+		return speeds[i];
+	};
 
-void TransferController::runOnSpecificDepth(std::vector<unsigned int> &depth_v)
-{
-	for (const auto &depth : depth_v)
+	double plateau = measure(0);
+	std::size_t previous = 0;
+	unsigned int flat_steps = 0;
+	while (previous + 1 < series.size() && flat_steps < 2)
 	{
-		this->depth = depth;
-		DLOG(INFO) << "FIFO depth value set to: " << depth;
-		setupFPGA();
-		for (const auto &size : cfgs.pattern_size_v)
+		std::size_t next = previous + 1;
+		while (next + 1 < series.size() &&
+			   series[next].pattern_size < static_cast<uint64_t>(step_ratio) * series[previous].pattern_size)
 		{
-			pattern_size = size;
-			runOnSpecificPatternSize();
+			next++;
 		}
+		double speed = measure(next);
+		flat_steps = (speed <= plateau * (1.0 + tolerance)) ? flat_steps + 1 : 0;
+		plateau = std::max(plateau, speed);
+		previous = next;
 	}
-}
 
-void TransferController::specifyDepth(std::vector<unsigned int> &depth_v)
-{
-	transfer_direction = cfgs.direction_m[direction];
-
-	DLOG(INFO) << "Specifying depth based on " << transfer_mode << " mode and " 
-			   << direction << " direction";
-
-	if (transfer_mode != DUPLEX)
+	if (flat_steps < 2)
 	{
-		depth_v = cfgs.depth_v;
-		if (transfer_mode == NONSYM && transfer_direction == WRITE)
+		LOG(WARNING) << "No plateau for " << series[0].mode << " " << series[0].direction << " "
+					 << series[0].memory << " " << series[0].depth << " " << series[0].pattern
+					 << " up to " << series.back().pattern_size << " B, fastest " << plateau << " B/s";
+		knee_report.add(serial, series[0], 0, 0.0, measured_count);
+	}
+	else
+	{
+		// Knee: smallest measured size within the tolerance of the plateau. The bisection keeps
+		// the threshold of the coarse pass, so the bracket it narrows stays valid
+		const double knee_speed = plateau * (1.0 - tolerance);
+		std::size_t knee = 0;
+		while (!measured[knee] || speeds[knee] < knee_speed) knee++;
+		std::size_t slow = knee;
+		if (knee > 0)
 		{
-			unsigned int depth_val_to_change = 16;
-			for (auto &depth : depth_v)
-			{
-				if (depth == depth_val_to_change)
-				{
-					depth = 32;
-					DLOG(WARNING) << "Changed depth 16 to 32 for NONSYM WRITE mode";
-				}
-			}
-			DLOG(INFO) << "Depth values specified for NONSYM mode and WRITE direction";
+			slow = knee - 1;
+			while (!measured[slow]) slow--;
 		}
-		DLOG(INFO) << "Depth values copied from config file";
+		while (knee > slow + 1)
+		{
+			std::size_t middle = slow + (knee - slow) / 2;
+			if (measure(middle) >= knee_speed) knee = middle;
+			else slow = middle;
+		}
+		// A faster bisection size raises the plateau, and the knee has to meet the raised one
+		plateau = *std::max_element(speeds.begin(), speeds.end());
+		while (!measured[knee] || speeds[knee] < plateau * (1.0 - tolerance)) knee++;
+		knee_report.add(serial, series[knee], series[knee].pattern_size, plateau, measured_count);
 	}
-	else
+	for (const auto &point : series)
 	{
-		depth_v = {2048}; // TODO: Fill in (2048????)
-		DLOG(INFO) << "Depth values specified for DUPLEX mode";
+		progress.advance(point);
 	}
 }
 
-void TransferController::specifyDirection(std::vector<std::string> &direction_v)
+void TransferController::loadBitfile(const std::string &bitfile)
 {
-	if (transfer_mode == DUPLEX)
+	if (bitfile == loaded_bitfile) return;
 	{
-		direction_v.push_back("bidir");
+		TRACE_SCOPE("bitfile load");
+		okdev::setupFPGA(dev, bitfile);
 	}
-	else
+	loaded_bitfile = bitfile;
+	if (!overhead_calibrated && cfgs.calibration_samples > 0)
 	{
-		direction_v = cfgs.direction_v;
+		TRACE_SCOPE("overhead calibration");
+		overhead = okdev::calibrateControlOverhead(dev, cfgs.calibration_samples);
+		overhead_calibrated = true;
 	}
-	DLOG(INFO) << "Specified direction for " << mode;
 }
 
-void TransferController::runOnSpecificMemory(std::vector<std::string> &memory_v)
+// Times doubling chunk sizes on one test point per mode and direction and keeps the fastest
+void TransferController::autotuneChunkSizes(const std::vector<TestPoint> &points)
 {
-	std::vector<std::string> direction_v;
-	specifyDirection(direction_v);
+	TRACE_SCOPE("chunk autotune");
+	const unsigned int max_tuning_size = 64 << 20;
+	const unsigned int block = cfgs.transfer_block_size ? cfgs.transfer_block_size : 16;
 
-	for (const auto &direction : direction_v)
+	std::set<std::pair<std::string, std::string>> tuned;
+	for (const auto &candidate : points)
 	{
-		this->direction = direction;
-		DLOG(INFO) << "Direction transfer mode set to: " << direction;
-		for (const auto &memory : memory_v)
+		if (cfgs.mode_m.at(candidate.mode) == DUPLEX) continue;
+		if (!tuned.insert({candidate.mode, candidate.direction}).second) continue;
+
+		// Largest pattern up to the cap, else the smallest one
+		const TestPoint *point = &candidate;
+		for (const auto &other : points)
+		{
+			if (other.mode != candidate.mode || other.direction != candidate.direction) continue;
+			bool fits = other.pattern_size <= max_tuning_size;
+			bool point_fits = point->pattern_size <= max_tuning_size;
+			if ((fits && (!point_fits || other.pattern_size > point->pattern_size)) ||
+				(!fits && !point_fits && other.pattern_size < point->pattern_size))
+			{
+				point = &other;
+			}
+		}
+
+		loadBitfile(point->bitfile);
+		mode = point->mode;
+		direction = point->direction;
+		memory = point->memory;
+		depth = point->depth;
+		pattern_size = point->pattern_size;
+		block_size = point->block_size;
+		pattern = point->pattern;
+		transfer_mode = cfgs.mode_m.at(mode);
+		transfer_direction = cfgs.direction_m.at(direction);
+
+		unsigned int best_chunk = 0;
+		double best_speed = 0.0;
+		unsigned int first_chunk = (16384 + block - 1) / block * block;
+		for (chunk_size = first_chunk; ; chunk_size *= 2)
 		{
-			this->memory = memory;
-			DLOG(INFO) << "FIFO memory mode set to: " << memory;
-			std::vector<unsigned int> depth_v;
-			specifyDepth(depth_v);
-			runOnSpecificDepth(depth_v);
+			if (chunk_size >= pattern_size) chunk_size = pattern_size;
+			if (transfer_direction == READ) performReadTimer();
+			else performWriteTimer();
+
+			double speed = pcSpeed();
+			LOG(INFO) << "Chunk size " << chunk_size << " B for " << mode << " " << direction << ": " << speed << " B/s";
+			if (speed > best_speed)
+			{
+				best_speed = speed;
+				best_chunk = chunk_size;
+			}
+			if (chunk_size >= pattern_size) break;
 		}
+		LOG(INFO) << "Fastest chunk size for " << mode << " " << direction << ": " << best_chunk << " B";
+		tuning.store(serial, mode, direction, best_chunk, best_speed);
 	}
+	tuning.save();
 }
 
-void TransferController::runOnSpecificMode()
+void TransferController::performTransferController(const std::vector<TestPoint> &points)
 {
-	std::vector<std::string> memory_v_for_specific_mode;
+	LOG(INFO) << "Device " << serial << ": " << points.size() << " test points";
+	if (cfgs.autotune_chunks && cfgs.transfer_chunk_size == 0) autotuneChunkSizes(points);
+	else if (cfgs.autotune_chunks) LOG(WARNING) << "Fixed transfer_chunk_size set. Skipping chunk auto-tune";
 
-	if (transfer_mode == NONSYM)
+	// Adaptive sweep: every configuration's sizes form one series, searched in plan order
+	std::vector<std::string> series_order;
+	std::map<std::string, std::vector<TestPoint>> series;
+	for (const auto &point : points)
 	{
-		memory_v_for_specific_mode = {"blockram"};
-		DLOG(WARNING) << "FYI: For nonsym mode, the only valid memory is blockram";
-	}
-	else
-	{
-		memory_v_for_specific_mode = cfgs.memory_v;
-		DLOG(INFO) << "Initialized memory vector for: " << mode;
+		if (cfgs.sweep_mode == "adaptive" && cfgs.mode_m.at(point.mode) != DUPLEX)
+		{
+			std::string key = point.bitfile + "|" + point.pattern;
+			if (series.find(key) == series.end()) series_order.push_back(key);
+			series[key].push_back(point);
+			continue;
+		}
+		// With ci_target a point may end before statistic_iter, and its rows are written together
+		if (completed.containsAll(point) || (cfgs.ci_target > 0.0 && completed.contains(point, 1)))
+		{
+			DLOG(INFO) << "Test point already recorded. Skipping.";
+			progress.skip(point);
+			continue;
+		}
+		loadBitfile(point.bitfile);
+		runTestPoint(point);
+		progress.advance(point);
 	}
-	runOnSpecificMemory(memory_v_for_specific_mode);
-}
 
-void TransferController::performTransferController()
-{
-	DLOG(INFO) << "Memory allocated for Results class";
-	for (const auto &mode : cfgs.mode_v)
+	for (const auto &key : series_order)
 	{
-		this->mode = mode;
-		transfer_mode = cfgs.mode_m[mode];
-		DLOG(INFO) <<  "Transfer mode set to: : " << mode;
-		runOnSpecificMode();
+		std::vector<TestPoint> &sizes = series[key];
+		std::sort(sizes.begin(), sizes.end(), [](const TestPoint &a, const TestPoint &b)
+		{
+			return a.pattern_size < b.pattern_size;
+		});
+		runAdaptiveSeries(sizes);
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,83 @@
+#include "performance.h"
+
+std::string ChunkTuning::key(const std::string &serial, const std::string &mode, const std::string &direction)
+{
+	return serial + "|" + mode + "|" + direction;
+}
+
+unsigned int ChunkTuning::lookup(const std::string &serial, const std::string &mode, const std::string &direction)
+{
+	std::lock_guard<std::mutex> lock(tuning_mutex);
+	auto it = tuned.find(key(serial, mode, direction));
+	return it == tuned.end() ? 0 : it->second.first;
+}
+
+void ChunkTuning::store(const std::string &serial, const std::string &mode, const std::string &direction,
+						unsigned int chunk_size, double speed)
+{
+	std::lock_guard<std::mutex> lock(tuning_mutex);
+	tuned[key(serial, mode, direction)] = {chunk_size, speed};
+}
+
+void ChunkTuning::load()
+{
+	std::ifstream tuning_file(path);
+	if (!tuning_file.good())
+	{
+		DLOG(INFO) << "No tuned chunk sizes in " << path;
+		return;
+	}
+
+	std::string line;
+	std::getline(tuning_file, line); // header
+	while (std::getline(tuning_file, line))
+	{
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty()) continue;
+		std::vector<std::string> fields = splitRow(line, sep);
+		if (fields.size() != 5)
+		{
+			LOG(FATAL) << "Malformed line in " << path << ": " << line;
+		}
+		unsigned long chunk_size = 0;
+		double speed = 0;
+		try
+		{
+			chunk_size = std::stoul(fields[3]);
+			speed = std::stod(fields[4]);
+		}
+		catch (const std::exception &)
+		{
+			LOG(FATAL) << "Malformed line in " << path << ": " << line;
+		}
+		// Tuned with another pipe block size, the chunks would not split into whole blocks
+		if (chunk_size == 0 || chunk_size % 16 != 0 || (block_size > 0 && chunk_size % block_size != 0))
+		{
+			LOG(FATAL) << "Tuned chunk size " << chunk_size << " in " << path << " is not a multiple of 16 B"
+					   << (block_size > 0 ? " and of the pipe block size" : "") << ". Delete the file to tune again";
+		}
+		store(fields[0], fields[1], fields[2], chunk_size, speed);
+	}
+	LOG(INFO) << "Loaded " << tuned.size() << " tuned chunk sizes from " << path;
+}
+
+void ChunkTuning::save()
+{
+	std::lock_guard<std::mutex> lock(tuning_mutex);
+	std::ofstream tuning_file(path, std::ios::trunc);
+	if (!tuning_file.good())
+	{
+		LOG(ERROR) << "Unable to save tuned chunk sizes to " << path;
+		return;
+	}
+	tuning_file << "DeviceSerial" << sep << "Mode" << sep << "Direction" << sep << "ChunkSize" << sep
+				<< "Speed [B/s]" << '\n';
+	for (const auto &entry : tuned)
+	{
+		std::string fields = entry.first;
+		std::size_t pos;
+		while ((pos = fields.find('|')) != std::string::npos) fields.replace(pos, 1, sep);
+		tuning_file << fields << sep << entry.second.first << sep << entry.second.second << '\n';
+	}
+	LOG(INFO) << "Tuned chunk sizes saved to " << path;
+}